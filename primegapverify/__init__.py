@@ -12,14 +12,15 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
-from .utils import sieve, sieve_factor, validate, is_prime_large, check_pfgw_available
+from .utils import sieve, sieve_buffer, sieve_factor, sieve_factor_compact, sieve_windowed, sieve_primorial, sieve_primorial_range, sieve_primorial_batch, validate, generate_certificate, check_certificate, is_prime_large, check_pfgw_available
 from .parsenumber import parse_primorial_standard_form, parse
-from verify import sieve_limit
+from verify import sieve_limit, Sieve
 from ._version import __version__
 
 __all__ = [
     "parse_primorial_standard_form", "parse",
-    "sieve", "sieve_factor", "validate",
+    "sieve", "sieve_buffer", "sieve_factor", "sieve_factor_compact", "sieve_windowed", "sieve_primorial",
+    "sieve_primorial_range", "sieve_primorial_batch", "validate", "generate_certificate", "check_certificate",
     "is_prime_large", "check_pfgw_available",
-    "sieve_limit",
+    "sieve_limit", "Sieve",
 ]
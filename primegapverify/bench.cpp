@@ -0,0 +1,143 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* bench.cpp
+ * $ make bench && ./bench [quick|full [threads]]
+ *
+ * Time primes::iterator, sieve_util::sieve and sieve_util::sieve_factors over
+ * a grid of N bits, gaps and limits. Prints one JSON object, bench.py adds
+ * the Python binding and compares against a saved baseline.
+ *
+ * Each sieve is timed in two phases, "small" (limit = gap, only primes that
+ * hit the interval more than once) and "full" (limit).
+ */
+
+#include "verify/primes.hpp"
+#include "verify/sieve_util.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <gmp.h>
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Grid {
+    std::vector<size_t> bits;
+    std::vector<uint64_t> gaps;
+    std::vector<uint64_t> limits;
+};
+
+static const Grid QUICK = {
+    {500, 10'000, 100'000},
+    {1'000, 100'000},
+    {1'000'000, 100'000'000},
+};
+
+static const Grid FULL = {
+    {500, 2'000, 10'000, 100'000},
+    {1'000, 100'000, 10'000'000, 1 << 26},
+    {1'000'000, 100'000'000, 10'000'000'000},
+};
+
+// Comma separates records in the "results" list.
+static bool first_record = true;
+
+void print_record(const char *bench, size_t bits, uint64_t gap, uint64_t limit,
+                  const char *phase, double seconds, uint64_t primes) {
+    printf("%s\n    {\"bench\": \"%s\", \"bits\": %zu, \"gap\": %lu, \"limit\": %lu, "
+           "\"phase\": \"%s\", \"seconds\": %.6f, \"primes\": %lu, \"primes_per_sec\": %.0f}",
+           first_record ? "" : ",", bench, bits, gap, limit, phase, seconds, primes,
+           seconds > 0 ? primes / seconds : 0.0);
+    first_record = false;
+}
+
+void bench_iterator(const Grid &grid) {
+    for (uint64_t limit : grid.limits) {
+        // Starting from 0 and from a large start (jump_to and a cold sieve)
+        for (uint64_t start : {(uint64_t) 0, limit * 100}) {
+            uint64_t stop = start + limit;
+            auto t0 = std::chrono::steady_clock::now();
+            primes::iterator iter(start, stop);
+            uint64_t count = 0;
+            for (uint64_t p = iter.next(); p <= stop; p = iter.next())
+                count++;
+            print_record("iterator", 0, 0, limit, start == 0 ? "from_zero" : "offset",
+                         seconds_since(t0), count);
+        }
+    }
+}
+
+void bench_sieve(const Grid &grid, int threads) {
+    gmp_randstate_t rand;
+    gmp_randinit_default(rand);
+
+    mpz_t N;
+    mpz_init(N);
+    for (size_t bits : grid.bits) {
+        mpz_urandomb(N, rand, bits);
+        mpz_setbit(N, bits - 1);
+
+        for (uint64_t gap : grid.gaps) {
+            for (uint64_t limit : grid.limits) {
+                if (limit < gap) continue;
+
+                size_t prime_count = 0;
+                auto t0 = std::chrono::steady_clock::now();
+                sieve_util::sieve(N, gap, gap, prime_count, threads);
+                print_record("sieve", bits, gap, limit, "small", seconds_since(t0), prime_count);
+
+                t0 = std::chrono::steady_clock::now();
+                sieve_util::sieve(N, gap, limit, prime_count, threads);
+                print_record("sieve", bits, gap, limit, "full", seconds_since(t0), prime_count);
+
+                t0 = std::chrono::steady_clock::now();
+                sieve_util::sieve_factors(N, gap, limit, prime_count, threads);
+                print_record("sieve_factors", bits, gap, limit, "full", seconds_since(t0),
+                             prime_count);
+                fflush(stdout);
+            }
+        }
+    }
+    mpz_clear(N);
+    gmp_randclear(rand);
+}
+
+int main(int argc, char ** argv) {
+    bool full = argc > 1 && strcmp(argv[1], "full") == 0;
+    if (argc > 1 && !full && strcmp(argv[1], "quick") != 0) {
+        fprintf(stderr, "Usage: %s [quick|full [threads]]\n", argv[0]);
+        return 1;
+    }
+    int threads = argc > 2 ? atoi(argv[2]) : 1;
+    const Grid &grid = full ? FULL : QUICK;
+
+#ifdef HANDROLLED
+    const char *backend = "handrolled";
+#else
+    const char *backend = "primesieve";
+#endif
+
+    printf("{\"backend\": \"%s\", \"grid\": \"%s\", \"threads\": %d, \"results\": [",
+           backend, full ? "full" : "quick", threads);
+    bench_iterator(grid);
+    bench_sieve(grid, threads);
+    printf("\n]}\n");
+}
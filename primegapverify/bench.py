@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+# Copyright 2020 Seth Troisi
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""
+$ make bench && python3 bench.py [--full] [--save]
+
+Runs ./bench (native sieve and iterator timings), times the Python binding
+and compares every record against bench_baseline.json. Records more than
+--tolerance slower than the baseline are reported and the exit status is 1.
+
+--save replaces the baseline with this run, do this on the machine (and
+with the backend) the baseline is meant for.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+import gmpy2
+
+import utils
+import verify
+
+
+BASELINE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bench_baseline.json")
+
+
+def record(bits, gap, limit, phase, seconds, primes=0):
+    return {
+        "bench": "binding", "bits": bits, "gap": gap, "limit": limit, "phase": phase,
+        "seconds": round(seconds, 6), "primes": primes,
+        "primes_per_sec": round(primes / seconds) if seconds > 0 else 0,
+    }
+
+
+def bench_binding(bits_list, gap, limit):
+    """Time converting start (int, decimal str) and the result (bytes -> list)"""
+    results = []
+    state = gmpy2.random_state(1)
+    for bits in bits_list:
+        start = int(gmpy2.mpz_urandomb(state, bits) | (gmpy2.mpz(1) << (bits - 1)))
+
+        t0 = time.time()
+        verify.sieve_interval(start, gap, limit)
+        results.append(record(bits, gap, limit, "int", time.time() - t0))
+
+        t0 = time.time()
+        verify.sieve_interval(gmpy2.mpz(start).digits(), gap, limit)
+        results.append(record(bits, gap, limit, "digits", time.time() - t0))
+
+        t0 = time.time()
+        utils.sieve(start, gap, limit)
+        results.append(record(bits, gap, limit, "list", time.time() - t0))
+    return results
+
+
+def key(r):
+    return (r["bench"], r["bits"], r["gap"], r["limit"], r["phase"])
+
+
+def compare(run, baseline, tolerance, min_seconds):
+    if (run["backend"], run["grid"], run["threads"]) != \
+            (baseline["backend"], baseline["grid"], baseline["threads"]):
+        print("Baseline is for a different backend, grid or threads", file=sys.stderr)
+        return 0
+
+    old = {key(r): r for r in baseline["results"]}
+    regressions = 0
+    for r in run["results"]:
+        b = old.get(key(r))
+        if b is None or max(r["seconds"], b["seconds"]) < min_seconds:
+            continue
+        ratio = r["seconds"] / max(b["seconds"], 1e-9)
+        if ratio > 1 + tolerance:
+            regressions += 1
+            print("REGRESSION {:14s} bits={:<6} gap={:<8} limit={:<11} {:9s} "
+                  "{:.4f}s -> {:.4f}s ({:.2f}x)".format(
+                      *key(r), b["seconds"], r["seconds"], ratio), file=sys.stderr)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--full", action="store_true", help="full grid (slow)")
+    parser.add_argument("--threads", type=int, default=1)
+    parser.add_argument("--baseline", default=BASELINE)
+    parser.add_argument("--save", action="store_true", help="save this run as the baseline")
+    parser.add_argument("--tolerance", type=float, default=0.25,
+                        help="allowed slowdown before reporting (default 0.25 = 25%%)")
+    parser.add_argument("--min-seconds", type=float, default=0.01,
+                        help="ignore records faster than this (timer noise)")
+    args = parser.parse_args()
+
+    bench = os.path.join(os.path.dirname(os.path.abspath(__file__)), "bench")
+    output = subprocess.run(
+        [bench, "full" if args.full else "quick", str(args.threads)],
+        check=True, stdout=subprocess.PIPE).stdout
+    run = json.loads(output)
+
+    bits = (500, 10000, 100000) if not args.full else (500, 2000, 10000, 100000)
+    run["results"].extend(bench_binding(bits, 100000, 10 ** 6))
+
+    print(json.dumps(run, indent=1))
+
+    if args.save:
+        with open(args.baseline, "w") as f:
+            json.dump(run, f, indent=1)
+        return 0
+
+    if not os.path.exists(args.baseline):
+        print("No baseline ({}), run with --save".format(args.baseline), file=sys.stderr)
+        return 0
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    return 1 if compare(run, baseline, args.tolerance, args.min_seconds) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,90 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* bench_residues.cpp
+ * $ make bench_residues && ./bench_residues [num_primes [first_prime]]
+ *
+ * Compare N mod 2p with mpz_cdiv_ui per prime (the old large prime loop)
+ * against residue::RemainderTree for a range of N sizes.
+ */
+
+#include "verify/primes.hpp"
+#include "verify/residue.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <gmp.h>
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char ** argv) {
+    size_t num_primes = argc > 1 ? atol(argv[1]) : 200'000;
+    // Primes above 10^9 like the large prime loop sees.
+    uint64_t first_prime = argc > 2 ? atol(argv[2]) : 1'000'000'000;
+
+    std::vector<uint64_t> two_p;
+    primes::iterator iter(first_prime, 2 * first_prime);
+    while (two_p.size() < num_primes) {
+        two_p.push_back(2 * iter.next());
+    }
+
+    gmp_randstate_t rand;
+    gmp_randinit_default(rand);
+
+    printf("%8s  %10s  %10s  %10s  %14s  %14s\n",
+           "bits", "cdiv_ui", "packed", "tree", "speedup packed", "speedup tree");
+    for (size_t bits : {500, 1000, 2000, 4000, 8000, 16000, 32000, 64000, 100000}) {
+        mpz_t N;
+        mpz_init(N);
+        mpz_urandomb(N, rand, bits);
+        mpz_setbit(N, bits - 1);
+
+        std::vector<uint64_t> expected(two_p.size());
+        auto t0 = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < two_p.size(); i++) {
+            expected[i] = mpz_fdiv_ui(N, two_p[i]);
+        }
+        double t_cdiv = seconds_since(t0);
+
+        std::vector<uint64_t> packed(two_p.size());
+        t0 = std::chrono::steady_clock::now();
+        residue::mod_packed(N, two_p.data(), two_p.size(), packed.data());
+        double t_packed = seconds_since(t0);
+
+        std::vector<uint64_t> residues(two_p.size());
+        t0 = std::chrono::steady_clock::now();
+        residue::RemainderTree tree(N);
+        for (size_t i = 0; i < two_p.size(); i += tree.batch_size()) {
+            size_t count = std::min(tree.batch_size(), two_p.size() - i);
+            tree.mod(two_p.data() + i, count, residues.data() + i);
+        }
+        double t_tree = seconds_since(t0);
+
+        if (residues != expected || packed != expected) {
+            printf("MISMATCH at %zu bits\n", bits);
+            return 1;
+        }
+
+        printf("%8zu  %10.4f  %10.4f  %10.4f  %14.2f  %14.2f\n",
+               bits, t_cdiv, t_packed, t_tree, t_cdiv / t_packed, t_cdiv / t_tree);
+        mpz_clear(N);
+    }
+    gmp_randclear(rand);
+}
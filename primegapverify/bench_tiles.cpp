@@ -0,0 +1,99 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* bench_tiles.cpp
+ * $ make bench_tiles && ./bench_tiles [bits]
+ *
+ * Time sieve_util::sieve_factors with 0 to 3 small prime tiles against the
+ * original unsegmented sieve (one pass over the interval per prime) for a
+ * range of gaps. limit = gap so the small prime loop dominates.
+ */
+
+#include "verify/primes.hpp"
+#include "verify/sieve_util.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <gmp.h>
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The original sieve_factors, N must be larger than limit.
+std::vector<uint64_t> reference_sieve(mpz_t &N, uint64_t gap, uint64_t limit) {
+    gap += 1;
+    std::vector<uint64_t> composite(gap, 0);
+
+    for (uint64_t d = mpz_cdiv_ui(N, 2); d < gap; d += 2) {
+        composite[d] = 2;
+    }
+
+    primes::iterator iter;
+    iter.next();
+    for (uint64_t prime = iter.next(); prime <= limit; prime = iter.next()) {
+        uint64_t two_p = 2 * prime;
+        uint64_t first = mpz_cdiv_ui(N, two_p);
+        first += prime;
+        if (first >= two_p) first -= two_p;
+        for (uint64_t d = first; d < gap; d += two_p) {
+            composite[d] = prime;
+        }
+    }
+    return composite;
+}
+
+int main(int argc, char ** argv) {
+    size_t bits = argc > 1 ? atol(argv[1]) : 1000;
+
+    gmp_randstate_t rand;
+    gmp_randinit_default(rand);
+    mpz_t N;
+    mpz_init(N);
+    mpz_urandomb(N, rand, bits);
+    mpz_setbit(N, bits - 1);
+
+    printf("%10s  %10s", "gap", "reference");
+    for (int tiles = 0; tiles <= 3; tiles++) {
+        printf("  %7s%d", "tiles=", tiles);
+    }
+    printf("\n");
+
+    for (uint64_t gap : {10'000, 100'000, 1'000'000, 10'000'000, 1 << 26}) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto expected = reference_sieve(N, gap, gap);
+        printf("%10lu  %10.4f", gap, seconds_since(t0));
+
+        for (int tiles = 0; tiles <= 3; tiles++) {
+            sieve_util::SieveStats stats;
+            stats.tile_groups = tiles;
+            size_t prime_count;
+            t0 = std::chrono::steady_clock::now();
+            auto factors = sieve_util::sieve_factors(N, gap, gap, prime_count, 1, &stats);
+            printf("  %8.4f", seconds_since(t0));
+            if (factors != expected) {
+                printf("\nMISMATCH with tiles=%d\n", tiles);
+                return 1;
+            }
+        }
+        printf("\n");
+    }
+
+    mpz_clear(N);
+    gmp_randclear(rand);
+}
@@ -29,113 +29,678 @@
  * [1] See math in next_prime.c in gmp-lib (by Seth)
  */
 
+#include "verify/autotune.hpp"
+#include "verify/certificate.hpp"
+#include "verify/checkpoint.hpp"
 #include "verify/primes.hpp"
+#include "verify/prp.hpp"
+#include "verify/residue.hpp"
 #include "verify/sieve_util.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #include <gmp.h>
 
 typedef long long ll;
 
+// N = m * P# / d + a, sieve [N, N + gap]
+struct GapInput {
+    ll m, p, d, a, gap;
+    // Line of the -b file, for errors.
+    size_t line = 0;
+};
+
+// Exit status when --prp finds a gap that doesn't verify.
+const int EXIT_NOT_VERIFIED = 2;
+
+/**
+ * --binary output, one record per gap. Every field is written little endian
+ * (see write_unknowns) whatever the host's byte order.
+ * Followed by count uint32 offsets, candidate i is N + offsets[i].
+ */
+struct BinaryHeader {
+    char magic[8];  // "PGVSIEV1"
+    uint64_t m, P, d;
+    int64_t a;
+    uint64_t gap;
+    uint64_t count;
+    uint64_t reserved;
+};
+static_assert(sizeof(BinaryHeader) == 64, "BinaryHeader must be packed");
+
+/**
+ * Buffers output and writes it in large chunks, integers are formatted by
+ * hand as printf per line is slow with millions of lines.
+ */
+class OutputWriter {
+    public:
+        OutputWriter(FILE *out) : out(out), buffer(BUFFER_SIZE), pos(0) {};
+        ~OutputWriter() { flush(); }
+
+        void write(const void *data, size_t size) {
+            if (pos + size > buffer.size()) {
+                flush();
+                if (size > buffer.size()) {
+                    fwrite(data, 1, size, out);
+                    return;
+                }
+            }
+            memcpy(buffer.data() + pos, data, size);
+            pos += size;
+        }
+
+        // Low bytes of value, little endian
+        void write_le(uint64_t value, size_t bytes) {
+            unsigned char le[8];
+            for (size_t i = 0; i < bytes; i++) {
+                le[i] = value >> (8 * i);
+            }
+            write(le, bytes);
+        }
+
+        // Writes value then newline
+        void write_line(ll value) {
+            if (pos + 22 > buffer.size()) flush();
+
+            char digits[20];
+            int len = 0;
+            unsigned long long v = value < 0 ? -(unsigned long long) value : value;
+            do {
+                digits[len++] = '0' + v % 10;
+                v /= 10;
+            } while (v);
+
+            if (value < 0) buffer[pos++] = '-';
+            while (len) buffer[pos++] = digits[--len];
+            buffer[pos++] = '\n';
+        }
+
+        void flush() {
+            fwrite(buffer.data(), 1, pos, out);
+            pos = 0;
+        }
+
+    private:
+        static const size_t BUFFER_SIZE = 1 << 20;
+
+        FILE *out;
+        std::vector<char> buffer;
+        size_t pos;
+};
+
 void print_usage(char *name) {
-    printf("Usage %s  m P d a gapsize [limit]\n\n", name);
+    printf("Usage %s  [--binary] [--prp] [--autotune] [--progress s]\n", name);
+    printf("      %*s  [--checkpoint file [--checkpoint-seconds s]] [--certificate file]\n",
+           (int) strlen(name), "");
+    printf("      %*s  [--window-file file]\n", (int) strlen(name), "");
+    printf("      %*s  m P d a gapsize [limit [threads]]\n", (int) strlen(name), "");
+    printf("      %s  [--binary] [--prp] [--autotune] [--progress s] -b file [limit [threads]]\n",
+           name);
+    printf("      %s  [--binary] [--prp] [--autotune] [--progress s]\n", name);
+    printf("      %*s  -r count m P d a gapsize [limit [threads]]\n", (int) strlen(name), "");
+    printf("      %s  [--prp] -c certificate [threads]\n\n", name);
     printf("Sieve and ouput numbers to check (including endpoints)\n\n");
+    printf("With -b reads \"m P d a gapsize\" per line from file (- for stdin),\n");
+    printf("primes are enumerated once for all gaps and output is in input order.\n");
+    printf("Lines that can't be sieved are reported to stderr and skipped (exit status 1).\n\n");
+    printf("With -r sieves m, m+1, ..., m+count-1 (same P, d, a, gapsize) together,\n");
+    printf("each prime's residue is computed once for all m.\n\n");
+    printf("With --prp candidates are PRP tested (with threads) instead of printed,\n");
+    printf("a summary line is printed per gap and exit status is %d if any gap\n",
+           EXIT_NOT_VERIFIED);
+    printf("doesn't verify.\n\n");
+    printf("With --checkpoint sieve and PRP progress is saved to file every 60\n");
+    printf("(or --checkpoint-seconds) seconds and resumed from it if it matches.\n\n");
+    printf("With --autotune (and no limit) the limit minimizes sieve + PRP time using\n");
+    printf("this machine's measured speeds, cached per size in ~/.cache/primegapverify_costs.txt\n");
+    printf("(or $PRIMEGAPVERIFY_COSTS).\n\n");
+    printf("With --progress the sieve prints progress (with ETA) to stderr every s\n");
+    printf("seconds and per phase timings when done.\n\n");
+    printf("With --certificate file (and m P d a gapsize) the gap is sieved with factors\n");
+    printf("and PRP tested, if it verifies a certificate (factor of each odd interior\n");
+    printf("number, PRP tested offsets) is written to file.\n");
+    printf("With -c the certificate is checked without sieving, all factors and the\n");
+    printf("endpoints are verified and the PRP tested interior is shown composite with\n");
+    printf("one Fermat test each (with --prp a full PRP retest).\n\n");
+    printf("With --window-file gaps up to 2^40 are sieved a window at a time into a\n");
+    printf("bitmap in file (memory use doesn't grow with the gap), then the candidates\n");
+    printf("are printed. Not supported with --binary, --prp, --checkpoint or --certificate.\n\n");
+    printf("With --binary each gap is a 64 byte header (magic \"PGVSIEV1\", then m, P,\n");
+    printf("d, a, gap, count, 0 as 64 bit little endian) followed by count uint32\n");
+    printf("offsets from N = m * P# / d + a.\n\n");
 }
 
-void calc_N(mpz_t &N, ll m, ll p, ll d, ll a) {
-    mpz_primorial_ui(N, p);
-    mpz_mul_ui(N, N, m);
+// Largest gap sieved in memory, see --window-file for larger.
+const ll MAX_GAP = 7000000;
 
-    // Verify d divides P#
-    assert(0 == mpz_tdiv_q_ui(N, N, d));
+// Problems are printed to out.
+bool valid_input(const GapInput &input, ll max_gap = MAX_GAP, FILE *out = stdout) {
+    if (input.m <= 0 || input.m > INT32_MAX) {
+        fprintf(out, "Invalid m=%lld\n", input.m);
+        return false;
+    }
 
-    assert(-a > 0);
-    mpz_sub_ui(N, N, -a);
+    if (input.p <= 50 || input.p > 40000) {
+        fprintf(out, "Invalid p=%lld\n", input.p);
+        return false;
+    }
+    if (!primes::isprime_brute(input.p)) {
+        fprintf(out, "P(%lld) not prime!\n", input.p);
+        return false;
+    }
+
+    if (input.d <= 0) {
+        fprintf(out, "Invalid d=%lld\n", input.d);
+        return false;
+    }
+
+    if (input.a >= 0 || input.a < -6000000) {
+        fprintf(out, "Invalid a=%lld\n", input.a);
+        return false;
+    }
+
+    if (input.gap <= input.a || input.gap > max_gap || input.gap % 2 == 1) {
+        fprintf(out, "Invalid gap=%lld\n", input.gap);
+        return false;
+    }
+    return true;
 }
 
-int main(int argc, char ** argv) {
-    if (argc < 6 || argc > 7) {
-        print_usage(argv[0]);
+// Bad records are reported on stderr, skipped and set failed.
+std::vector<GapInput> read_inputs(const char *path, bool &failed) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == nullptr) {
+        printf("Can't open %s\n", path);
         exit(1);
     }
 
-    // Validate input
-    ll m = atol(argv[1]);
-    ll p = atol(argv[2]);
-    ll d = atol(argv[3]);
-    ll a = atol(argv[4]);
-    ll gap = atol(argv[5]);
+    std::vector<GapInput> inputs;
+    char line[256];
+    for (size_t line_num = 1; fgets(line, sizeof(line), file); line_num++) {
+        GapInput input;
+        int parsed = sscanf(line, "%lld %lld %lld %lld %lld",
+                            &input.m, &input.p, &input.d, &input.a, &input.gap);
+        if (parsed == EOF) {
+            continue;  // blank line
+        }
+        if (parsed != 5 || !valid_input(input, MAX_GAP, stderr)) {
+            line[strcspn(line, "\n")] = '\0';
+            fprintf(stderr, "line %ld: bad input \"%s\", skipping\n", line_num, line);
+            failed = true;
+            continue;
+        }
+        input.line = line_num;
+        inputs.push_back(input);
+    }
+
+    if (file != stdin) fclose(file);
+    return inputs;
+}
+
+// Sieve limit for N unless one was given.
+uint64_t input_limit(const GapInput &input, const mpz_t &N, uint64_t limit, bool autotune) {
+    int bits = mpz_sizeinbase(N, 2);
+    autotune::Costs costs;
+    if (limit == 0 && autotune &&
+            autotune::get_costs(autotune::default_cache_path(), "gmp", bits, costs)) {
+        limit = autotune::optimal_sievelimit(input.gap, costs);
+        fprintf(stderr, "autotune: PRP %.2e s, sieve %.2e primes/s\n",
+                costs.prp_seconds, costs.primes_per_sec);
+    }
+    if (limit == 0) {
+        limit = sieve_util::calculate_sievelimit(bits, input.gap);
+    }
+    fprintf(stderr, "bits: %5d  gap: %6lld  limit: %'ld\n", bits, input.gap, limit);
+    fprintf(stderr, "expect ~~%.0f remaining\n", 1.0 * input.gap / (log(limit) * 1.7811));
+    return limit;
+}
+
+// Write the odd numbers composite didn't mark, composite is from sieve_odds.
+void write_unknowns(OutputWriter &writer, bool binary, const GapInput &input, const mpz_t &N,
+                    const std::vector<char> &composite, size_t prime_count, bool write = true) {
+    // Only odd numbers are returned
+    ll first_odd = mpz_even_p(N) ? 1 : 0;
+    size_t odds = (input.gap - first_odd) / 2 + 1;
+    assert(composite.size() == odds);
+
+    /* Final stats */
+    ll gap = input.gap;
+    size_t unknowns = std::count(composite.begin(), composite.end(), 0);
+    size_t count_c = gap - unknowns;
+    fprintf(stderr, "%lld / %lld = %.2f composite, %ld remaining (primes %ld)\n",
+            gap - unknowns, gap, 100.0 * count_c / gap, unknowns, prime_count);
+
+    /* Output */
+    if (!write) {
+        return;
+    }
+    if (binary) {
+        BinaryHeader header = {{'P', 'G', 'V', 'S', 'I', 'E', 'V', '1'},
+            (uint64_t) input.m, (uint64_t) input.p, (uint64_t) input.d, input.a,
+            (uint64_t) gap, unknowns, 0};
+        writer.write(header.magic, sizeof(header.magic));
+        for (uint64_t field : {header.m, header.P, header.d, (uint64_t) header.a,
+                               header.gap, header.count, header.reserved}) {
+            writer.write_le(field, sizeof(field));
+        }
+        for(size_t i = 0; i < composite.size(); i++) {
+            if (!composite[i]) {
+                writer.write_le(first_odd + 2*i, sizeof(uint32_t));
+            }
+        }
+        return;
+    }
+
+    char prefix[80];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%lld * %lld# / %lld + ",
+                              input.m, input.p, input.d);
+    for(size_t i = 0; i < composite.size(); i++) {
+        if (!composite[i]) {
+            writer.write(prefix, prefix_len);
+            writer.write_line(input.a + first_odd + 2*i);
+        }
+    }
+}
+
+struct Options {
+    bool binary = false;
+    bool prp = false;
     uint64_t limit = 0;
-    if (argc == 7) {
-        limit = atol(argv[6]);
+    int threads = 1;
+    // Resume from and periodically save to this file.
+    std::string checkpoint;
+    double checkpoint_seconds = 60;
+    // Print sieve progress this often and timings at the end, 0 for never.
+    double progress_seconds = 0;
+    // Pick limit from measured PRP and sieve speed (if not given).
+    bool autotune = false;
+    // Write a certificate of the verified gap to this file.
+    std::string certificate;
+    // Sieve out of core into a bitmap in this file.
+    std::string window_file;
+};
+
+void print_stats(const sieve_util::SieveStats &stats) {
+    fprintf(stderr, "sieve stats: small %.3fs (%lu primes, %lu marks), "
+            "large %.3fs (%lu primes, %lu marks), even pass %.3fs\n",
+            stats.small_seconds, stats.small_primes, stats.small_marks,
+            stats.large_seconds, stats.large_primes, stats.large_marks,
+            stats.expand_seconds);
+}
+
+/**
+ * PRP tests the survivors of [N, N + gap] and prints a summary line.
+ * Returns if the gap verified.
+ */
+bool prp_gap(const Options &options, const GapInput &input, const mpz_t &N,
+             const std::vector<char> &composite, checkpoint::Checkpointer *ckpt) {
+    prp::GapResult result;
+    if (ckpt) {
+        result = ckpt->test_gap(N, options.threads);
+    } else {
+        ll first_odd = mpz_even_p(N) ? 1 : 0;
+        std::vector<uint64_t> offsets;
+        for(size_t i = 0; i < composite.size(); i++) {
+            if (!composite[i]) {
+                offsets.push_back(first_odd + 2*i);
+            }
+        }
+        result = prp::test_gap(N, input.gap, offsets, options.threads);
     }
 
-    if (m <= 0 || m > INT32_MAX) {
-        printf("Invalid m=%lld\n", m);
+    if (result.verified) {
+        printf("%lld * %lld# / %lld + %lld  gap %lld verified (%ld PRP tests)\n",
+               input.m, input.p, input.d, input.a, input.gap, result.tests);
+    } else {
+        bool endpoint = result.failed_offset == 0 || result.failed_offset == (uint64_t) input.gap;
+        printf("%lld * %lld# / %lld + %lld  gap %lld NOT verified, %lld is %s (%ld PRP tests)\n",
+               input.m, input.p, input.d, input.a, input.gap,
+               input.a + (ll) result.failed_offset, endpoint ? "composite" : "prime",
+               result.tests);
+    }
+    fflush(stdout);
+    return result.verified;
+}
+
+// Writes candidates (or PRP tests them), returns false if --prp didn't verify the gap.
+bool output_gap(OutputWriter &writer, const Options &options, const GapInput &input,
+                const mpz_t &N, const std::vector<char> &composite, size_t prime_count,
+                checkpoint::Checkpointer *ckpt = nullptr) {
+    write_unknowns(writer, options.binary, input, N, composite, prime_count, !options.prp);
+    return !options.prp || prp_gap(options, input, N, composite, ckpt);
+}
+
+int batch_main(const char *path, const Options &options) {
+    // Records that can't be sieved are reported and skipped, the rest still run.
+    bool failed = false;
+    std::vector<GapInput> inputs = read_inputs(path, failed);
+    fprintf(stderr, "sieving %ld gaps\n", inputs.size());
+
+    std::vector<GapInput> valid;
+    std::vector<residue::Primorial> forms;
+    std::vector<uint64_t> gaps;
+    std::vector<uint64_t> limits;
+    mpz_t N;
+    mpz_init(N);
+    for (const auto &input : inputs) {
+        residue::Primorial form = {
+            (uint64_t) input.m, (uint64_t) input.p, (uint64_t) input.d, input.a};
+        if (!form.value(N)) {
+            fprintf(stderr, "line %ld: d=%lld doesn't divide P#, skipping\n", input.line, input.d);
+            failed = true;
+            continue;
+        }
+        valid.push_back(input);
+        forms.push_back(form);
+        gaps.push_back(input.gap);
+        limits.push_back(input_limit(input, N, options.limit, options.autotune));
+    }
+
+    sieve_util::SieveStats stats;
+    stats.progress_seconds = options.progress_seconds;
+    const bool show_stats = options.progress_seconds > 0;
+
+    std::vector<size_t> prime_counts;
+    auto composites = sieve_util::sieve_odds_batch(
+        forms, gaps, limits, prime_counts, options.threads, show_stats ? &stats : nullptr);
+    if (show_stats) print_stats(stats);
+
+    OutputWriter writer(stdout);
+    bool verified = true;
+    for (size_t k = 0; k < valid.size(); k++) {
+        if (composites[k].empty()) {
+            fprintf(stderr, "line %ld: sieve failed, skipping\n", valid[k].line);
+            failed = true;
+            continue;
+        }
+        forms[k].value(N);
+        verified &= output_gap(writer, options, valid[k], N, composites[k], prime_counts[k]);
+    }
+    mpz_clear(N);
+    if (failed) return 1;
+    return verified ? 0 : EXIT_NOT_VERIFIED;
+}
+
+int range_main(uint64_t count, const GapInput &first, const Options &options) {
+    GapInput last = first;
+    last.m += count - 1;
+    if (count == 0 || !valid_input(first) || !valid_input(last)) {
         exit(1);
     }
+    fprintf(stderr, "sieving m = [%lld, %lld] * %lld# / %lld + [%lld, %lld]\n",
+            first.m, last.m, first.p, first.d, first.a, first.a + first.gap);
 
-    if (p <= 50 || p > 40000) {
-        printf("Invalid p=%lld\n", p);
+    const residue::Primorial form = {
+        (uint64_t) first.m, (uint64_t) first.p, (uint64_t) first.d, first.a};
+    mpz_t N;
+    mpz_init(N);
+    if (!form.value(N)) {
+        printf("d=%lld doesn't divide P#\n", first.d);
         exit(1);
     }
-    if (!primes::isprime_brute(p)) {
-        printf("P(%lld) not prime!", p);
+    uint64_t limit = input_limit(first, N, options.limit, options.autotune);
+    mpz_clear(N);
+
+    sieve_util::SieveStats stats;
+    stats.progress_seconds = options.progress_seconds;
+    const bool show_stats = options.progress_seconds > 0;
+
+    OutputWriter writer(stdout);
+    bool verified = true;
+    size_t prime_count = 0;
+    std::vector<char> composite;
+    auto on_row = [&](uint64_t i, const mpz_t &N_i, const char *row) {
+        GapInput input = first;
+        input.m += i;
+        mpz_t temp;
+        mpz_init_set(temp, N_i);
+        composite.assign(row, row + sieve_util::odd_count(temp, input.gap));
+        mpz_clear(temp);
+        verified &= output_gap(writer, options, input, N_i, composite, prime_count);
+        return true;
+    };
+    if (!sieve_util::sieve_odds_m_range(form, count, first.gap, limit, prime_count, on_row,
+                                        options.threads, show_stats ? &stats : nullptr)) {
+        printf("sieve failed\n");
         exit(1);
     }
+    if (show_stats) print_stats(stats);
+    return verified ? 0 : EXIT_NOT_VERIFIED;
+}
+
+int certificate_main(const GapInput &input, uint64_t limit, const Options &options) {
+    char N_str[100];
+    snprintf(N_str, sizeof(N_str), "%lld * %lld# / %lld - %lld",
+             input.m, input.p, input.d, -input.a);
 
-    if (d <= 0) {
-        printf("Invalid d=%lld\n", d);
+    certificate::Certificate cert;
+    prp::GapResult result = certificate::generate(N_str, input.gap, limit, options.threads, cert);
+    if (!result.verified) {
+        printf("%s  gap %lld NOT verified, no certificate written\n", N_str, input.gap);
+        return EXIT_NOT_VERIFIED;
+    }
+    if (!certificate::save(options.certificate, cert)) {
+        printf("Can't write %s\n", options.certificate.c_str());
+        return 1;
+    }
+    printf("%s  gap %lld verified, certificate (%ld factors, %ld PRP) written to %s\n",
+           N_str, input.gap, cert.factors.size(), cert.prp.size(), options.certificate.c_str());
+    return 0;
+}
+
+int windowed_main(const GapInput &input, const residue::Primorial &form, uint64_t limit,
+                  const Options &options) {
+    sieve_util::SieveStats stats;
+    stats.progress_seconds = options.progress_seconds;
+    const bool show_stats = options.progress_seconds > 0;
+
+    char prefix[80];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%lld * %lld# / %lld + ",
+                              input.m, input.p, input.d);
+    OutputWriter writer(stdout);
+    size_t prime_count = 0;
+    uint64_t unknowns = 0;
+    auto on_survivor = [&](uint64_t offset) {
+        writer.write(prefix, prefix_len);
+        writer.write_line(input.a + (ll) offset);
+        unknowns++;
+        return true;
+    };
+    if (!sieve_util::sieve_odds_windowed(form, input.gap, limit, options.window_file,
+                                         prime_count, on_survivor, options.threads,
+                                         show_stats ? &stats : nullptr)) {
+        printf("sieve failed (N must be larger than limit)\n");
         exit(1);
     }
+    if (show_stats) print_stats(stats);
+    fprintf(stderr, "%ld remaining of %lld (primes %ld)\n", unknowns, input.gap, prime_count);
+    return 0;
+}
+
+int check_main(const char *path, int threads, bool prp_interior) {
+    certificate::Certificate cert;
+    if (!certificate::load(path, cert)) {
+        printf("Can't read certificate %s\n", path);
+        return 1;
+    }
+
+    certificate::CheckResult result = certificate::check(cert, threads, prp_interior);
+    if (!result.valid) {
+        printf("%s  gap %ld certificate INVALID at offset %ld: %s\n",
+               cert.N.c_str(), cert.gap, result.failed_offset, result.reason);
+        return EXIT_NOT_VERIFIED;
+    }
+    printf("%s  gap %ld certificate valid (%ld factors, %ld primality tests)\n",
+           cert.N.c_str(), cert.gap, cert.factors.size(), result.prp_tests);
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    Options options;
+    while (argc >= 2 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--binary") == 0) {
+            options.binary = true;
+        } else if (strcmp(argv[1], "--prp") == 0) {
+            options.prp = true;
+        } else if (strcmp(argv[1], "--autotune") == 0) {
+            options.autotune = true;
+        } else if (strcmp(argv[1], "--checkpoint") == 0 && argc >= 3) {
+            options.checkpoint = argv[2];
+            argv[2] = argv[0];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--progress") == 0 && argc >= 3) {
+            options.progress_seconds = atof(argv[2]);
+            argv[2] = argv[0];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--window-file") == 0 && argc >= 3) {
+            options.window_file = argv[2];
+            argv[2] = argv[0];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--certificate") == 0 && argc >= 3) {
+            options.certificate = argv[2];
+            argv[2] = argv[0];
+            argv++;
+            argc--;
+        } else if (strcmp(argv[1], "--checkpoint-seconds") == 0 && argc >= 3) {
+            options.checkpoint_seconds = atof(argv[2]);
+            argv[2] = argv[0];
+            argv++;
+            argc--;
+        } else {
+            print_usage(argv[0]);
+            exit(1);
+        }
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
 
-    if (a >= 0 || a < -6000000) {
-        printf("Invalid a=%lld\n", a);
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "-c") == 0) {
+        int threads = argc == 4 ? atoi(argv[3]) : 1;
+        if (threads < 1 || threads > 1024) {
+            printf("Invalid threads=%d\n", threads);
+            exit(1);
+        }
+        return check_main(argv[2], threads, options.prp);
+    }
+
+    bool batch = argc >= 3 && strcmp(argv[1], "-b") == 0;
+    bool range = argc >= 3 && strcmp(argv[1], "-r") == 0;
+    int num_args = batch ? 3 : range ? 8 : 6;
+    if (argc < num_args || argc > num_args + 2) {
+        print_usage(argv[0]);
         exit(1);
     }
 
-    if (gap <= a || gap > 7000000 || gap % 2 == 1) {
-        printf("Invalid gap=%lld\n", gap);
+    if (argc >= num_args + 1) {
+        options.limit = atol(argv[num_args]);
+    }
+    if (argc >= num_args + 2) {
+        options.threads = atoi(argv[num_args + 1]);
+    }
+
+    if (options.limit > 11'000'000'000'000) {
+        printf("Invalid limit=%ld\n", options.limit);
+    }
+
+    if (options.threads < 1 || options.threads > 1024) {
+        printf("Invalid threads=%d\n", options.threads);
+        exit(1);
+    }
+
+    if ((batch || range) && !(options.certificate.empty() && options.window_file.empty())) {
+        printf("--certificate and --window-file are only supported for a single gap\n");
+        exit(1);
+    }
+    if (!options.window_file.empty() && (options.binary || options.prp ||
+            !options.checkpoint.empty() || !options.certificate.empty())) {
+        printf("--window-file only prints candidates\n");
         exit(1);
     }
 
-    if (limit > 11'000'000'000'000) {
-        printf("Invalid limit=%ld\n", limit);
+    if (batch) {
+        if (!options.checkpoint.empty()) {
+            printf("--checkpoint isn't supported with -b\n");
+            exit(1);
+        }
+        return batch_main(argv[2], options);
+    }
+
+    if (range) {
+        if (!options.checkpoint.empty()) {
+            printf("--checkpoint isn't supported with -r\n");
+            exit(1);
+        }
+        GapInput first = {atol(argv[3]), atol(argv[4]), atol(argv[5]), atol(argv[6]), atol(argv[7])};
+        return range_main(atol(argv[2]), first, options);
+    }
+
+    // Validate input
+    GapInput input = {atol(argv[1]), atol(argv[2]), atol(argv[3]), atol(argv[4]), atol(argv[5])};
+    bool windowed = !options.window_file.empty();
+    if (!valid_input(input, windowed ? sieve_util::MAX_WINDOWED_GAP : MAX_GAP)) {
+        exit(1);
     }
 
-	fprintf(stderr, "sieving %lld * %lld# / %lld + [%lld, %lld]\n", m, p, d, a, a+gap);
+	fprintf(stderr, "sieving %lld * %lld# / %lld + [%lld, %lld]\n",
+            input.m, input.p, input.d, input.a, input.a + input.gap);
 
     /* N = m * P# / d - a */
+    const residue::Primorial form = {
+        (uint64_t) input.m, (uint64_t) input.p, (uint64_t) input.d, input.a};
     mpz_t N;
     mpz_init(N);
-    calc_N(N, m, p, d, a);
+    if (!form.value(N)) {
+        printf("d=%lld doesn't divide P#\n", input.d);
+        exit(1);
+    }
 
     /* Input stats */
-    int bits = mpz_sizeinbase(N, 2);
-    if (limit == 0) {
-        limit = sieve_util::calculate_sievelimit(bits, gap);
-    }
-    fprintf(stderr, "bits: %5d  gap: %6lld  limit: %'ld\n", bits, gap, limit);
-    fprintf(stderr, "expect ~~%.0f remaining\n", 1.0 * gap / (log(limit) * 1.7811));
+    uint64_t limit = input_limit(input, N, options.limit, options.autotune);
 
-    size_t prime_count = 0;
-    auto composite = sieve_util::sieve(N, gap, limit, prime_count);
-    size_t odds = gap / 2 + 1;
-    assert(composite.size() == odds);
+    if (!options.certificate.empty()) {
+        mpz_clear(N);
+        return certificate_main(input, limit, options);
+    }
+    if (windowed) {
+        mpz_clear(N);
+        return windowed_main(input, form, limit, options);
+    }
 
-    /* Final stats */
-    size_t unknowns = std::count(composite.begin(), composite.end(), 0);
-    size_t count_c = gap - unknowns;
-    fprintf(stderr, "%lld / %lld = %.2f composite, %ld remaining (primes %ld)\n",
-            gap - unknowns, gap, 100.0 * count_c / gap, unknowns, prime_count);
+    sieve_util::SieveStats stats;
+    stats.progress_seconds = options.progress_seconds;
+    const bool show_stats = options.progress_seconds > 0;
 
-    /* Output */
-    for(size_t i = 0; i < composite.size(); i++) {
-        if (!composite[i]) {
-            printf("%lld * %lld# / %lld + %lld\n", m, p, d, a+2*i);
+    size_t prime_count = 0;
+    OutputWriter writer(stdout);
+    bool verified;
+    if (options.checkpoint.empty()) {
+        // Residues come from m, P#, d, a which avoids big integers for primes <= P.
+        auto composite = sieve_util::sieve_odds(form, input.gap, limit, prime_count, options.threads,
+                                                show_stats ? &stats : nullptr);
+        if (show_stats) print_stats(stats);
+        verified = output_gap(writer, options, input, N, composite, prime_count);
+    } else {
+        checkpoint::Checkpointer ckpt(
+            options.checkpoint, options.checkpoint_seconds, N, input.gap, limit);
+        if (!ckpt.sieve(N, &form, prime_count, options.threads, show_stats ? &stats : nullptr)) {
+            printf("sieve failed\n");
+            exit(1);
         }
+        if (show_stats) print_stats(stats);
+        verified = output_gap(writer, options, input, N, ckpt.state.composite, prime_count, &ckpt);
     }
+    mpz_clear(N);
+    return verified ? 0 : EXIT_NOT_VERIFIED;
 }
@@ -0,0 +1,52 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* prime_table.cpp
+ * $ make prime_table && ./prime_table primes.bin 10000000000
+ * $ export PRIMEGAPVERIFY_PRIMES=$PWD/primes.bin
+ *
+ * Writes the primes up to limit as a mod 30 wheel bitmap (see primes.hpp).
+ * With PRIMEGAPVERIFY_PRIMES set every large_sieve run and Python sieve
+ * reads primes from one shared mapping of the file instead of sieving them.
+ */
+
+#include "verify/primes.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char ** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s file limit\n", argv[0]);
+        return 1;
+    }
+
+    uint64_t limit = atof(argv[2]);
+    if (limit < 30 || limit > 1'000'000'000'000) {
+        fprintf(stderr, "Invalid limit=%s\n", argv[2]);
+        return 1;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (!primes::write_table(argv[1], limit)) {
+        fprintf(stderr, "Can't write %s\n", argv[1]);
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    fprintf(stderr, "wrote primes <= %lu (%.1f MB) to %s in %.1f seconds\n",
+            limit, (limit / 30 + 1) / 1e6, argv[1], seconds);
+    return 0;
+}
@@ -13,11 +13,13 @@
 # limitations under the License.
 
 import math
+import threading
 
 import gmpy2
 
 import parsenumber
 import utils
+import verify
 
 
 def brute(s, g, mp):
@@ -135,6 +137,353 @@ def test_zero_one_composite():
         if s + g - 1 >= 1:
             assert composites[1 - s] == True
 
+def test_sieve_buffer():
+    for s, g, mp in (
+        (0, 10, 10),
+        (1001, 1000, 50),
+        (10 ** 30 + 1, 20000, 10 ** 6),
+    ):
+        buf = utils.sieve_buffer(s, g, mp)
+        assert isinstance(buf, bytes)
+        assert len(memoryview(buf)) == g + 1
+        assert [bool(b) for b in buf] == brute(s, g, mp)
+
+
+def test_sieve_factor_compact():
+    for s, g, mp in (
+        (0, 100, 10),
+        (1, 99, 100),
+        (1001, 1000, 50),
+        (10 ** 30 + 1, 20000, 10 ** 6),
+    ):
+        expect = utils.sieve_factor(s, g, mp)
+        first_odd, factors, large = utils.sieve_factor_compact(s, g, mp)
+        assert first_odd == 1 - s % 2
+        factors = memoryview(factors).cast('I')
+        large = memoryview(large).cast('Q')
+        large = dict(zip(large[::2], large[1::2]))
+
+        for i, f in enumerate(factors):
+            if f == 2 ** 32 - 1:
+                f = large[i]
+            assert f == expect[first_odd + 2 * i]
+
+
+def test_sieve_threads():
+    # Threaded sieve should exactly match single threaded
+    for s, g, mp in (
+        (1, 99, 100),
+        (1001, 1000, 50),
+        (10 ** 30 + 1, 20000, 10 ** 6),
+        (parsenumber.parse("11051077202945*97#/30 -1754"), 2900, 10 ** 6),
+    ):
+        assert utils.sieve(s, g, mp, threads=4) == utils.sieve(s, g, mp)
+        assert utils.sieve_factor(s, g, mp, threads=3) == utils.sieve_factor(s, g, mp)
+
+def test_sieve_windowed(tmp_path):
+    path = str(tmp_path / "bitmap")
+    for s, g, mp in (
+        (10 ** 30 + 1, 20000, 10 ** 6),
+        (2 ** 100, 12345, 10 ** 5),
+        (10 ** 20 + 7, 100, 1000),
+    ):
+        composite = utils.sieve(s, g, mp)
+        expect = [i for i, c in enumerate(composite) if not c and (s + i) % 2 == 1]
+        assert list(utils.sieve_windowed(s, g, path, mp)) == expect
+        assert list(utils.sieve_windowed(s, g, path, mp, threads=3)) == expect
+
+    # Offsets come from C++ in chunks, the generator can stop early
+    s, g, mp = 10 ** 20 + 1, 3 * 10 ** 6, 10 ** 5
+    chunks = []
+    count = verify.sieve_interval_windowed(s, g, mp, path, 1, None, chunks.append)
+    assert count == sum(map(len, chunks)) and len(chunks) > 1
+    offsets = [o for chunk in chunks for o in chunk]
+    assert offsets == sorted(offsets) and all((s + o) % 2 for o in offsets)
+    first = utils.sieve_windowed(s, g, path, mp)
+    assert [next(first) for _ in range(10)] == offsets[:10]
+    first.close()
+
+    def stop(chunk):
+        raise KeyError("stop")
+    try:
+        verify.sieve_interval_windowed(s, g, mp, path, 1, None, stop)
+        assert False, "on_offsets raised"
+    except KeyError:
+        pass
+
+    # Primes in the interval would mark themselves
+    try:
+        verify.sieve_interval_windowed(100, 100, 1000, path)
+        assert False, "start <= max_prime"
+    except ValueError:
+        pass
+
+
+def test_sieve_session():
+    # Extending must match sieving with the final distance and max_prime
+    for start in (10 ** 30 + 1, 2 ** 100, "7 * 103# / 35 - 500", 1000, 10 ** 6 + 3):
+        n = parsenumber.parse(start) if isinstance(start, str) else start
+        s = verify.Sieve(start, 500)
+        assert s.survivors() == (500 + 1 + (n % 2)) // 2
+        for g, mp in ((500, 300), (500, 10 ** 4), (1001, 10 ** 4), (1002, 10 ** 4),
+                      (3000, 10 ** 4), (3000, 2 * 10 ** 5), (3000, 2 * 10 ** 5)):
+            s.extend_interval(g)
+            s.extend_limit(mp)
+            assert (s.distance, s.max_prime) == (g, mp)
+            composites = s.composites()
+            assert composites == utils.sieve_buffer(n, g, mp)
+            assert s.survivors() == sum(1 for i, c in enumerate(composites)
+                                        if not c and (n + i) % 2 == 1)
+
+    s = verify.Sieve(10 ** 20 + 7, 100, 1000, threads=2)
+    assert s.composites() == utils.sieve_buffer(10 ** 20 + 7, 100, 1000)
+    assert s.prime_count > 0
+    try:
+        s.extend_interval(2 ** 27)
+        assert False, "distance too large"
+    except ValueError:
+        pass
+    assert s.distance == 100
+
+    # Calls racing an extend either run or raise RuntimeError (how many raise
+    # depends on timing), the session is never replaced underneath it.
+    s = verify.Sieve(10 ** 30 + 1, 1000, 1000)
+    worker = threading.Thread(target=s.extend_limit, args=(10 ** 7,))
+    worker.start()
+    while worker.is_alive():
+        try:
+            s.__init__(10 ** 30 + 1, 1000, 1000)
+        except RuntimeError:
+            pass
+    worker.join()
+    assert s.max_prime in (1000, 10 ** 7)
+    assert s.composites() == utils.sieve_buffer(10 ** 30 + 1, 1000, s.max_prime)
+
+
+def test_sieve_primorial():
+    # Structured sieve must match sieving the expanded number
+    for num_str, g, mp in (
+        ("11051077202945*97#/30 -1754", 2900, 10 ** 6),
+        ("1 * 53# / 30 + 10", 1000, 10 ** 5),
+        ("7 * 103# / 35 - 500", 1000, 10 ** 5),
+        ("3 * 211# / 2 - 100", 5000, 2 * 10 ** 6),
+        ("7 * 13# / 2 + 0", 100, 1000),
+    ):
+        m, p, d, a = parsenumber.parse_primorial_standard_form(num_str)
+        start = parsenumber.parse(num_str)
+        expect = utils.sieve(start, g, mp)
+        assert utils.sieve_primorial(m, p, d, a, g, mp) == expect, num_str
+        assert utils.sieve_primorial(m, p, d, a, g, mp, threads=3) == expect, num_str
+
+def test_sieve_primorial_range():
+    # Range of m must match sieving each m alone, including small N (N <= limit)
+    for m, count, p, d, a, g, mp in (
+        (1000, 50, 97, 30, -1754, 2900, 10 ** 6),
+        (1, 20, 53, 30, 10, 1000, 10 ** 5),
+        (1, 10, 13, 2, 0, 100, 1000),
+        (3, 7, 211, 2, -100, 5000, 2 * 10 ** 6),
+    ):
+        expect = [bytes(utils.sieve_primorial(m + i, p, d, a, g, mp)) for i in range(count)]
+        assert list(utils.sieve_primorial_range(m, count, p, d, a, g, mp)) == expect
+        assert list(utils.sieve_primorial_range(m, count, p, d, a, g, mp, threads=3)) == expect
+
+    rows = []
+    try:
+        verify.sieve_primorial_range(1, 10, 13, 17, 0, 100, 1000, rows.append)
+        assert False, "d doesn't divide P#"
+    except ValueError:
+        pass
+
+    try:
+        verify.sieve_primorial_range(1, 2 ** 64 - 1, 503, 210, -100, 100, 1000, rows.append)
+        assert False, "m + count overflows"
+    except ValueError:
+        pass
+
+    # Exceptions from on_row stop the sieve
+    def on_row(i, row):
+        rows.append(i)
+        if i == 2:
+            raise KeyError(i)
+    try:
+        verify.sieve_primorial_range(1, 10, 13, 2, 0, 100, 1000, on_row)
+        assert False, "on_row raised"
+    except KeyError:
+        pass
+    assert rows == [0, 1, 2]
+
+
+def test_sieve_primorial_batch():
+    # Batch (shared large primes) must match sieving each record alone,
+    # records that can't be sieved are None and don't affect the rest.
+    records = [
+        (1000, 97, 30, -1754, 2900, 10 ** 6),
+        (1, 53, 30, 10, 1000, 10 ** 5),
+        (7, 13, 2, 0, 100, 1000),
+        (1, 13, 17, 0, 100, 1000),
+        (3, 211, 2, -100, 5000, 2 * 10 ** 6),
+        (1001, 97, 30, -1754, 2900, 10 ** 7),
+    ]
+    expect = []
+    for m, p, d, a, g, mp in records:
+        expect.append(None if d == 17 else bytes(utils.sieve_primorial(m, p, d, a, g, mp)))
+
+    stats = {}
+    assert utils.sieve_primorial_batch(records, stats=stats) == expect
+    assert stats["large_primes"] > 0
+    assert utils.sieve_primorial_batch(records, threads=3) == expect
+    assert utils.sieve_primorial_batch([]) == []
+
+    try:
+        verify.sieve_primorial_batch([(1, 13, 2, 0, 0, 1000)])
+        assert False, "bad gap"
+    except ValueError:
+        pass
+
+
+def test_sieve_start_types():
+    # int, mpz, bytes and str (decimal or standard form) starts are equivalent
+    for num_str, g, mp in (
+        ("11051077202945*97#/30 -1754", 2900, 10 ** 5),
+        ("1 * 53# / 30 + 10", 1000, 10 ** 5),
+        ("7 * (103#) / 35 - 500", 1000, 10 ** 5),
+        ("(53#)/7# + 1", 100, 1000),
+        ("5 * 67# / (7# * 11) + 1", 100, 1000),
+        ("5 * 67# / (7 * 11) - 3", 100, 1000),
+        ("13# + 1", 100, 1000),
+    ):
+        start = parsenumber.parse(num_str)
+        expect = verify.sieve_interval(str(start), g, mp)
+        raw = start.to_bytes(start.bit_length() // 8 + 1, "little")
+        for n in (start, gmpy2.mpz(start), raw, num_str):
+            assert verify.sieve_interval(n, g, mp) == expect, (num_str, n)
+
+    for bad in ("12 * 7#", "5 * 7# ^ 3 + 1", "(11 * 13#)/6+1", "11#/(2*3)+1"):
+        try:
+            verify.sieve_interval(bad, 10, 100)
+            assert False, bad
+        except ValueError:
+            pass
+
+def test_sieve_stats():
+    s, g, mp = 10 ** 30 + 1, 20000, 10 ** 6
+    stats = {}
+    assert utils.sieve(s, g, mp, stats=stats) == utils.sieve(s, g, mp)
+    assert stats["small_primes"] + stats["large_primes"] == 78498
+    assert stats["small_primes"] == 2262  # primes <= 20001
+    # Each odd number is written once per prime factor
+    large_marks = 0
+    p = gmpy2.next_prime(g)
+    while p <= mp:
+        large_marks += (s + g) // p - (s - 1) // p
+        large_marks -= (s + g) // (2 * p) - (s - 1) // (2 * p)
+        p = gmpy2.next_prime(p)
+    assert stats["large_marks"] == large_marks
+    assert stats["small_marks"] >= sum(1 for f in utils.sieve_factor(s, g, mp) if 0 < f <= g)
+    for key in ("small_seconds", "large_seconds", "expand_seconds", "convert_seconds"):
+        assert stats[key] >= 0
+
+    primorial = {}
+    utils.sieve_primorial(1, 503, 210, -2654, 10 ** 5, 10 ** 5, stats=primorial)
+    assert primorial["convert_seconds"] > 0
+
+    for threads in (1, 3):
+        compact = {"progress_seconds": 0}
+        utils.sieve_factor_compact(s, g, mp, threads=threads, stats=compact)
+        assert compact["large_marks"] == stats["large_marks"]
+        assert compact["large_primes"] == stats["large_primes"]
+
+    validate_stats = {"progress_seconds": 0.01}
+    assert utils.validate(1009, 4, stats=validate_stats)
+    assert validate_stats["small_primes"] > 0
+
+def test_sieve_tiles():
+    # Largest factor from stamped tiles must match marking each prime
+    s, mp = 10 ** 30 + 1, 3000
+    for g, tiles in ((10000, 0), (40000, 2), (10 ** 6, 2)):
+        expect = [0 if (s + i) % 2 else 2 for i in range(g + 1)]
+        p = 3
+        while p <= mp:
+            for i in range((-s) % p, g + 1, p):
+                if (s + i) % 2:
+                    expect[i] = p
+            p = int(gmpy2.next_prime(p))
+
+        for threads in (1, 3):
+            stats = {}
+            assert utils.sieve_factor(s, g, mp, threads, stats) == expect, (g, threads)
+            assert stats["small_tiles"] == tiles, (g, stats["small_tiles"])
+
+
+def test_prime_table(tmp_path, monkeypatch):
+    path = str(tmp_path / "primes.bin")
+    verify.write_prime_table(path, 10 ** 6)
+    with open(path, "rb") as f:
+        table = f.read()
+    assert table[:8] == b"PGVPRIM1"
+    assert len(table) == 16 + 10 ** 6 // 30 + 1
+
+    # Primes past the end of the table are sieved.
+    cases = ((10 ** 30 + 1, 20000, 10 ** 6), (10 ** 30 + 1, 20000, 3 * 10 ** 6),
+             (2 ** 100, 1000, 10 ** 5))
+    expect = [utils.sieve(s, g, mp) for s, g, mp in cases]
+    monkeypatch.setenv("PRIMEGAPVERIFY_PRIMES", path)
+    for (s, g, mp), e in zip(cases, expect):
+        assert utils.sieve(s, g, mp) == e
+        assert utils.sieve(s, g, mp, threads=3) == e
+
+    # The table is what's read: 1000003 = 30 * 33333 + 13 (bit 3) dropped.
+    s = 1000003 * int(gmpy2.next_prime(10 ** 19))
+    assert utils.sieve(s, 10, 10 ** 6 + 10)[0]
+    path = str(tmp_path / "broken.bin")
+    verify.write_prime_table(path, 10 ** 7)
+    with open(path, "r+b") as f:
+        f.seek(16 + 33333)
+        byte = f.read(1)[0]
+        f.seek(16 + 33333)
+        f.write(bytes([byte & ~(1 << 3)]))
+    monkeypatch.setenv("PRIMEGAPVERIFY_PRIMES", path)
+    assert not utils.sieve(s, 10, 10 ** 6 + 10)[0]
+
+
+def test_sieve_limit_autotune(tmp_path, monkeypatch):
+    costs = tmp_path / "costs.txt"
+    monkeypatch.setenv("PRIMEGAPVERIFY_COSTS", str(costs))
+
+    # Cheap PRP tests => small limit, expensive => large limit
+    cheap = verify.sieve_limit(1000, 10000, True, "fake_cheap", lambda: 1e-6)
+    costly = verify.sieve_limit(1000, 10000, True, "fake_costly", lambda: 10.0)
+    assert 1000 <= cheap < costly <= 10 ** 10
+
+    # Cached per (bits, backend), measure_prp isn't called again
+    def fail():
+        assert False, "cached"
+    assert verify.sieve_limit(1000, 10000, True, "fake_cheap", fail) == cheap
+    assert "fake_costly 1001 " in costs.read_text()
+
+    # Longer gap => more survivors to test => larger limit
+    assert verify.sieve_limit(1000, 100000, True, "fake_cheap", fail) > cheap
+
+    # Too small to measure, same as the formula
+    assert utils.sieve_limit(10 ** 6, 100, autotune=True) == utils.sieve_limit(10 ** 6, 100)
+
+    s, g = 9691983639208775401081992556968666567067, 2982
+    assert utils.validate(s, g, max_prime="auto")
+    assert "gmp 133 " in costs.read_text()
+
+    # Concurrent first runs (the GIL is released while measuring) keep every entry
+    workers = [threading.Thread(target=verify.sieve_limit,
+                                args=(800, 10000, True, "fake_%d" % i, lambda: 1e-3))
+               for i in range(4)]
+    for worker in workers:
+        worker.start()
+    for worker in workers:
+        worker.join()
+    text = costs.read_text()
+    assert all("fake_%d 801 " % i in text for i in range(4)), text
+    assert "fake_costly 1001 " in text
+    assert sorted(p.name for p in tmp_path.iterdir()) == ["costs.txt", "costs.txt.lock"]
+
 # TODO sieve_factor tests
 
 def test_validate():
@@ -147,6 +496,88 @@ def test_validate():
             assert not utils.validate(s, g - 2)
         assert not utils.validate(s, g + 2)
 
+def test_validate_interval():
+    s, g = 9691983639208775401081992556968666567067, 2982
+    for threads in (1, 3):
+        assert utils.validate(s, g, threads=threads)
+        assert verify.validate_interval(str(s), g, 10 ** 5, threads) is None
+        # End isn't prime
+        assert verify.validate_interval(str(s), g + 2, 10 ** 5, threads) == g + 2
+        assert verify.validate_interval(str(s + 2), g - 2, 10 ** 5, threads) == 0
+
+    # Interior primes
+    assert verify.validate_interval("101", 6, 10, 2) == 2
+    assert verify.validate_interval("2", 3, 10) == 1
+    assert verify.validate_interval("2", 1, 10) is None
+
+def test_validate_checkpoint(tmp_path):
+    s, g = 9691983639208775401081992556968666567067, 2982
+    path = str(tmp_path / "checkpoint")
+    assert utils.validate(s, g, checkpoint=path)
+    # Resumes (with everything already tested)
+    assert utils.validate(s, g, checkpoint=path)
+    assert verify.validate_interval(str(s), g, 10 ** 5, 2, path) is None
+    # Different interval ignores the checkpoint
+    assert verify.validate_interval(str(s), g + 2, 10 ** 5, 2, path) == g + 2
+
+    # Fewer odds than the interval has is ignored too
+    assert verify.validate_interval(str(s), g, 10 ** 5, 2, path) is None
+    with open(path, "rb") as f:
+        data = bytearray(f.read())
+    # Header fields are little endian
+    assert data[:8] == b"PGVCKPT2"
+    assert int.from_bytes(data[8:16], "little") == g
+    assert int.from_bytes(data[16:24], "little") == 10 ** 5
+    n_size = int.from_bytes(data[40:48], "little")
+    assert data[48:48 + n_size] == format(s, "x").encode()
+    odds_at = 48 + n_size
+    odds = int.from_bytes(data[odds_at:odds_at + 8], "little")
+    assert odds == g // 2 + 1
+    data[odds_at:odds_at + 8] = (odds - 1000).to_bytes(8, "little")
+    with open(path, "wb") as f:
+        f.write(data)
+    assert verify.validate_interval(str(s), g, 10 ** 5, 2, path) is None
+
+def test_certificate(tmp_path):
+    path = str(tmp_path / "cert.txt")
+    for start, g in (
+        ("1 * 503# / 210 - 2654", 1140),
+        (parsenumber.parse("1 * 503# / 210 - 2654"), 1140),
+        (1425172824437699411, 1476),
+    ):
+        assert utils.generate_certificate(start, g, path, threads=2)
+        assert utils.check_certificate(path)
+        assert utils.check_certificate(path, threads=3, prp=True)
+
+    with open(path) as f:
+        lines = f.read().split("\n")
+    factors = [i for i, line in enumerate(lines) if line.startswith("factors ")][0]
+    count = int(lines[factors].split()[1])
+
+    # Wrong factor
+    offset, f = map(int, lines[factors + 1].split())
+    bad = lines[:factors + 1] + ["{} {}".format(offset, f + 2)] + lines[factors + 2:]
+    with open(path, "w") as out:
+        out.write("\n".join(bad))
+    assert verify.check_certificate(path) == (offset, "factor doesn't divide N + offset")
+
+    # Missing claim
+    bad = lines[:factors] + ["factors {}".format(count - 1)] + lines[factors + 2:]
+    with open(path, "w") as out:
+        out.write("\n".join(bad))
+    assert verify.check_certificate(path)[0] == offset
+
+    assert not utils.generate_certificate(1425172824437699411, 1478, path)
+
+    # Listing primes as PRP tested doesn't make them composite
+    with open(path, "w") as out:
+        out.write("\n".join(["PGVCERT1", "N 1009", "gap 24", "prp 13"] +
+                             [str(o) for o in range(0, 25, 2)] + ["factors 0", ""]))
+    assert verify.check_certificate(path) == (22, "PRP tested offset isn't composite")
+    assert verify.check_certificate(path, 1, True)[0] == 22
+    assert not utils.check_certificate(path, threads=3)
+
+
 def test_validate_string():
     assert utils.validate("11051077202945*97#/30 -1754", 2900)
     assert utils.validate(1009, 4)
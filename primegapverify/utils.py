@@ -13,7 +13,9 @@
 # limitations under the License.
 
 import math
+import queue
 import subprocess
+import threading
 import time
 
 import gmpy2
@@ -22,16 +24,67 @@ from primegapverify import parsenumber
 import verify
 
 def _get_max_prime(start, gap, max_prime):
+    if max_prime == "auto":
+        return sieve_limit(start, gap, autotune=True)
     if max_prime is None or max_prime <= 1:
-        log2 = float(gmpy2.log2(start + gap))
-        max_prime = verify.sieve_limit(log2, gap)
+        max_prime = sieve_limit(start, gap)
     return max_prime
 
 
-def sieve(start, gap, max_prime=None):
+def _time_pfgw(bits):
+    """Seconds for one pfgw test of a random composite with bits bits"""
+    state = gmpy2.random_state(bits)
+    num = gmpy2.mpz_urandomb(state, bits) | (gmpy2.mpz(1) << (bits - 1)) | 1
+    while gmpy2.gcd(num, 3 * 5 * 7 * 11 * 13 * 17 * 19 * 23) != 1:
+        num += 2
+    t0 = time.time()
+    _is_prime_pfgw(num)
+    return time.time() - t0
+
+
+def sieve_limit(start, gap, autotune=False, backend="gmp"):
+    """
+    Sieve limit for [start, start+gap].
+
+    With autotune the limit minimizes sieve time + PRP time of the expected
+    survivors using this machine's measured speeds (cached on disk per size,
+    see verify.sieve_limit). backend is the PRP test used on the survivors,
+    "gmp" (validate) or "pfgw" (is_prime_large of large numbers).
+    max_prime="auto" in the sieve functions is the same as autotune=True.
+    """
+    log2 = float(gmpy2.log2(start + gap))
+    if not autotune:
+        return verify.sieve_limit(log2, gap)
+
+    if backend == "pfgw":
+        return verify.sieve_limit(log2, gap, True, backend, lambda: _time_pfgw(int(log2) + 1))
+    return verify.sieve_limit(log2, gap, True, backend)
+
+
+def sieve(start, gap, max_prime=None, threads=1, stats=None):
     """
     Sieve [start, start+gap] marking all composite numbers with factors less
     than max_prime as composite.
+
+    threads > 1 sieves with multiple threads (the GIL is released).
+
+    stats (a dict) is filled with per phase timings and counts, set
+    stats["progress_seconds"] to print progress to stderr.
+
+    Returns a list of bools, see sieve_buffer for a compact bytes result.
+    """
+    buf = sieve_buffer(start, gap, max_prime, threads, stats)
+    t0 = time.time()
+    composite = list(map(bool, buf))
+    if stats is not None:
+        stats["convert_seconds"] += time.time() - t0
+    return composite
+
+
+def sieve_buffer(start, gap, max_prime=None, threads=1, stats=None):
+    """
+    Same as sieve() but returns bytes (1 = composite, 0 = unknown) written
+    directly by the sieve, use numpy.frombuffer to wrap without a copy.
     """
 
     assert start >= 0, ("Negative start! ", start)
@@ -39,13 +92,11 @@ def sieve(start, gap, max_prime=None):
     max_prime = _get_max_prime(start, gap, max_prime)
     assert max_prime >= 2, max_prime
 
-    # str(start) only converts up to 4300 digits see PYTHONINTMAXSTRDIGITS
-    # gmpy2 is faster after 1000 digits and 10x faster after 10,000 digits
-    str_start = gmpy2.mpz(start).digits()
-    return verify.sieve_interval(str_start, gap, max_prime)
+    # start is passed in binary, avoids str(start) and PYTHONINTMAXSTRDIGITS
+    return verify.sieve_interval(start, gap, max_prime, threads, stats)
 
 
-def sieve_factor(start, gap, max_prime=None):
+def sieve_factor(start, gap, max_prime=None, threads=1, stats=None):
     """
     Sieve [start, start+gap] marking primes (less than max_prime) that divide
     numbers in the interval.
@@ -56,11 +107,163 @@ def sieve_factor(start, gap, max_prime=None):
     max_prime = _get_max_prime(start, gap, max_prime)
     assert max_prime >= 2, max_prime
 
-    return verify.sieve_factor_interval(str(start), gap, max_prime)
+    return verify.sieve_factor_interval(start, gap, max_prime, threads, stats)
+
+
+def sieve_factor_compact(start, gap, max_prime=None, threads=1, stats=None):
+    """
+    Same as sieve_factor() but in a compact form for large intervals.
+
+    Returns (first_odd, factors, large), only odd numbers are included:
+      factors[i] (uint32) is the factor of start + first_odd + 2*i, 2^32-1 if
+      the factor is listed in large as an (index, factor) uint64 pair.
+    Both are bytes, use memoryview(...).cast('I' or 'Q') to read them.
+    """
+
+    assert start >= 0, ("Negative start! ", start)
+    assert gap >= 1, gap
+    max_prime = _get_max_prime(start, gap, max_prime)
+    assert max_prime >= 2, max_prime
+
+    return verify.sieve_factor_interval_compact(start, gap, max_prime, threads, stats)
+
+
+def sieve_windowed(start, gap, path, max_prime=None, threads=1, stats=None):
+    """
+    Offsets of the odd numbers in [start, start+gap] without a factor less
+    than max_prime (in increasing order), for gaps too large for sieve().
+
+    The sieve is a bitmap in path (see verify.sieve_interval_windowed) which
+    is read a window at a time, so memory use doesn't grow with gap. Offsets
+    are produced natively in a background thread, a few chunks ahead.
+    """
+
+    assert start >= 0, ("Negative start! ", start)
+    assert gap >= 1, gap
+    max_prime = _get_max_prime(start, gap, max_prime)
+    assert max_prime >= 2, max_prime
+
+    chunks = queue.Queue(maxsize=4)
+    stop = threading.Event()
+    done = object()
+
+    class Stopped(Exception):
+        pass
+
+    def put(item):
+        while not stop.is_set():
+            try:
+                chunks.put(item, timeout=0.1)
+                return
+            except queue.Full:
+                pass
+        raise Stopped
+
+    def run():
+        try:
+            verify.sieve_interval_windowed(start, gap, max_prime, path, threads, stats, put)
+            put(done)
+        except Stopped:
+            pass
+        except BaseException as e:
+            if not stop.is_set():
+                chunks.put(e)
+
+    worker = threading.Thread(target=run, daemon=True)
+    worker.start()
+    try:
+        while True:
+            chunk = chunks.get()
+            if chunk is done:
+                break
+            if isinstance(chunk, BaseException):
+                raise chunk
+            yield from chunk
+    finally:
+        stop.set()
+        worker.join()
+
+
+def sieve_primorial(m, P, d, a, gap, max_prime=None, threads=1, stats=None):
+    """
+    Same as sieve(m * P# / d + a, gap, ...) but the sieve works from (m, P, d, a)
+    instead of a big integer start.
+    """
+
+    assert gap >= 1, gap
+    if max_prime == "auto" or max_prime is None or max_prime <= 1:
+        log2 = math.log2(m) + float(gmpy2.log2(gmpy2.primorial(P))) - math.log2(d)
+        max_prime = verify.sieve_limit(log2, gap, max_prime == "auto")
+
+    buf = verify.sieve_primorial_interval(m, P, d, a, gap, max_prime, threads, stats)
+    t0 = time.time()
+    composite = list(map(bool, buf))
+    if stats is not None:
+        stats["convert_seconds"] += time.time() - t0
+    return composite
+
+
+def sieve_primorial_batch(records, threads=1, stats=None):
+    """
+    Same as [sieve_buffer of each (m, P, d, a, gap, max_prime) record] but the
+    primes larger than every gap are enumerated once for all of them.
+
+    max_prime may be None or "auto" as in sieve_primorial. Records that can't
+    be sieved (d doesn't divide P#) give None.
+    """
+
+    resolved = []
+    for m, P, d, a, gap, max_prime in records:
+        assert gap >= 1, gap
+        if max_prime == "auto" or max_prime is None or max_prime <= 1:
+            log2 = math.log2(m) + float(gmpy2.log2(gmpy2.primorial(P))) - math.log2(d)
+            max_prime = verify.sieve_limit(log2, gap, max_prime == "auto")
+        resolved.append((m, P, d, a, gap, max_prime))
+
+    return verify.sieve_primorial_batch(resolved, threads, stats)
+
 
+def sieve_primorial_range(m, count, P, d, a, gap, max_prime=None, threads=1, stats=None):
+    """
+    Same as (sieve_primorial(m + i, P, d, a, gap, ...) for i in range(count))
+    but each prime's residue is computed once for a tile of intervals.
+
+    Generator of bytes (1 = composite) like sieve_buffer, only one tile of
+    rows (about 64MB) is held at once.
+    """
+
+    assert count >= 1, count
+    assert gap >= 1, gap
+    if max_prime == "auto" or max_prime is None or max_prime <= 1:
+        log2 = math.log2(m + count) + float(gmpy2.log2(gmpy2.primorial(P))) - math.log2(d)
+        max_prime = verify.sieve_limit(log2, gap, max_prime == "auto")
+
+    # Same tile size as sieve_util::M_RANGE_TILE_BYTES
+    tile = max(1, 2 ** 26 // (gap // 2 + 1))
+    for t in range(0, count, tile):
+        rows = []
+        verify.sieve_primorial_range(
+            m + t, min(tile, count - t), P, d, a, gap, max_prime,
+            lambda i, row: rows.append(row), threads, stats)
+        yield from rows
+
+
+def validate(start, gap, max_prime=None, verbose=False, threads=1, checkpoint=None,
+             stats=None):
+    """
+    Validate start, start+gap are prime and the interior is composite
+
+    Sieving and PRP tests run natively with threads (the GIL is released),
+    stopping at the first interior prime.
+
+    With checkpoint (a path) progress is saved every minute, calling again
+    with the same arguments resumes from it.
 
-def validate(start, gap, max_prime=None, verbose=False):
-    """Validate start, start+gap are prime and the interior is composite"""
+    max_prime="auto" picks the limit from measured speeds, see sieve_limit.
+
+    stats (a dict) is filled with the sieve's timings and counts, verbose
+    also prints progress every 10 seconds.
+    """
 
     # TODO return reason
 
@@ -78,44 +281,60 @@ def validate(start, gap, max_prime=None, verbose=False):
     assert start >= 0, ("Negative start! ", start)
     assert gap >= 1, gap
 
-    if not gmpy2.is_prime(start):
-        print("Start not prime!")
-        return False
-
-    if not gmpy2.is_prime(start + gap):
-        print("End not prime!")
-        return False
-
     max_prime = _get_max_prime(start, gap, max_prime)
     assert max_prime >= 2, max_prime
 
     if verbose:
         print("Sieving up to {:,}".format(max_prime))
         t0 = time.time()
+        if stats is None:
+            stats = {}
+        stats.setdefault("progress_seconds", 10)
 
-    composites = sieve(start, gap, max_prime)
-    assert gap + 1 == len(composites), (gap, len(composites))
+    offset = verify.validate_interval(start, gap, max_prime, threads, checkpoint, stats)
 
     if verbose:
-        t1 = time.time()
-        count_unknowns = composites.count(False)
-        test_i = 0
-        print("Sieve finished {} to test ({:.3f} seconds)".format(
-            count_unknowns, t1 - t0))
-
-
-    for i, composite in enumerate(composites[1:-1], 1):
-        if i % 2 == 1:
-            assert composite # all evens should be composite
-        if not composite:
-            if verbose:
-                test_i += 1
-                print("Testing {}, {}/{}".format(i, test_i, count_unknowns))
-            if gmpy2.is_prime(start + i):
-                print("Interior point is prime: start +", i)
-                return False
+        print("Sieve ({:.3f} seconds) and PRP tests finished ({:.3f} seconds)".format(
+            stats["small_seconds"] + stats["large_seconds"], time.time() - t0))
 
-    return True
+    if offset == 0:
+        print("Start not prime!")
+    elif offset == gap:
+        print("End not prime!")
+    elif offset is not None:
+        print("Interior point is prime: start +", offset)
+
+    return offset is None
+
+
+def generate_certificate(start, gap, path, max_prime=None, threads=1):
+    """
+    Validate [start, start+gap] and if valid write a certificate to path listing
+    a factor of each interior odd number and the PRP tested offsets.
+
+    start can be a standard form string (m * P# / d + a), which is kept in the
+    certificate so checking it can use the parts.
+    """
+    num = parsenumber.parse(start) if isinstance(start, str) else start
+    assert num and num >= 0, ("Bad start! ", start)
+    max_prime = _get_max_prime(num, gap, max_prime)
+
+    offset = verify.generate_certificate(start, gap, max_prime, path, threads)
+    if offset is not None:
+        print("Gap not valid at start +", offset)
+    return offset is None
+
+
+def check_certificate(path, threads=1, prp=False):
+    """
+    Check a certificate from generate_certificate without sieving, all factor
+    claims and the endpoints are verified and the interior PRP offsets are
+    shown composite (one Fermat test each). prp retests them fully (slow).
+    """
+    problem = verify.check_certificate(path, threads, prp)
+    if problem is not None:
+        print("Certificate invalid at start + {}: {}".format(*problem))
+    return problem is None
 
 
 def is_prime_large(num, str_num=None):
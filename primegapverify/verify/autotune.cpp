@@ -0,0 +1,221 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "autotune.hpp"
+#include "sieve_util.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gmp.h>
+
+namespace autotune {
+    namespace {
+        // Keep measuring until this much time was spent.
+        const double MIN_MEASURE_SECONDS = 0.2;
+
+        double seconds_since(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Random N with exactly bits bits
+        void random_n(gmp_randstate_t rand, uint32_t bits, mpz_t &N) {
+            mpz_urandomb(N, rand, bits);
+            mpz_setbit(N, bits - 1);
+        }
+
+        struct Entry {
+            std::string backend;
+            uint32_t bits;
+            Costs costs;
+        };
+
+        std::vector<Entry> load(const std::string &path) {
+            std::vector<Entry> entries;
+            std::ifstream file(path);
+            std::string line;
+            while (std::getline(file, line)) {
+                std::istringstream fields(line);
+                Entry entry;
+                if (fields >> entry.backend >> entry.bits >> entry.costs.prp_seconds
+                           >> entry.costs.primes_per_sec) {
+                    entries.push_back(entry);
+                }
+            }
+            return entries;
+        }
+
+        /**
+         * Adds entry to the cache at path. Many processes may share the cache so
+         * the file is re-read under an flock of path.lock, merged, written to a
+         * unique temp file and renamed over path.
+         */
+        bool add(const std::string &path, const Entry &added) {
+            std::string lock_path = path + ".lock";
+            int lock = open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (lock < 0) return false;
+            if (flock(lock, LOCK_EX) != 0) {
+                close(lock);
+                return false;
+            }
+
+            std::vector<Entry> entries = load(path);
+            bool found = false;
+            for (const auto &entry : entries) {
+                found |= entry.backend == added.backend && entry.bits == added.bits;
+            }
+            if (!found) entries.push_back(added);
+
+            std::string tmp = path + ".XXXXXX";
+            int fd = mkstemp(&tmp[0]);
+            FILE *f = fd >= 0 ? fdopen(fd, "w") : nullptr;
+            bool success = f != nullptr;
+            for (size_t i = 0; success && i < entries.size(); i++) {
+                const Entry &entry = entries[i];
+                success &= fprintf(f, "%s %u %.9g %.9g\n", entry.backend.c_str(), entry.bits,
+                                   entry.costs.prp_seconds, entry.costs.primes_per_sec) > 0;
+            }
+            if (f) success &= fclose(f) == 0;
+            else if (fd >= 0) close(fd);
+            // mkstemp creates 0600, the cache is as readable as a normal file.
+            success = success && chmod(tmp.c_str(), 0644) == 0 &&
+                rename(tmp.c_str(), path.c_str()) == 0;
+            if (!success && fd >= 0) unlink(tmp.c_str());
+
+            close(lock);  // Releases the flock
+            return success;
+        }
+    }
+
+    std::string default_cache_path() {
+        const char *path = getenv("PRIMEGAPVERIFY_COSTS");
+        if (path && *path) return path;
+
+        const char *home = getenv("HOME");
+        if (!home || !*home) return "primegapverify_costs.txt";
+
+        std::string dir = std::string(home) + "/.cache";
+        mkdir(dir.c_str(), 0755);  // Fine if it already exists
+        return dir + "/primegapverify_costs.txt";
+    }
+
+    bool get_costs(const std::string &path, const std::string &backend, uint32_t bits,
+                   Costs &costs, const std::function<double()> &measure_prp) {
+        if (!measure_prp && backend != "gmp") return false;
+        // Small N are sieved to sqrt(N) and PRP tests are nearly free.
+        if (bits < 64) return false;
+
+        if (!path.empty()) {
+            for (const auto &entry : load(path)) {
+                if (entry.backend == backend && entry.bits == bits) {
+                    costs = entry.costs;
+                    return true;
+                }
+            }
+        }
+
+        fprintf(stderr, "autotune: measuring %s PRP and sieve speed at %u bits\n",
+                backend.c_str(), bits);
+        costs.prp_seconds = measure_prp ? measure_prp() : measure_gmp_prp(bits);
+        costs.primes_per_sec = measure_sieve(bits);
+        if (!(costs.prp_seconds > 0) || !(costs.primes_per_sec > 0)) return false;
+
+        if (!path.empty()) {
+            if (!add(path, {backend, bits, costs})) {
+                fprintf(stderr, "autotune: couldn't save costs to %s\n", path.c_str());
+            }
+        }
+        return true;
+    }
+
+    double measure_gmp_prp(uint32_t bits) {
+        gmp_randstate_t rand;
+        gmp_randinit_default(rand);
+        mpz_t N;
+        mpz_init(N);
+
+        // Same reps as prp::test_gap, composites fail the first round.
+        double total = 0;
+        size_t tests = 0;
+        while (total < MIN_MEASURE_SECONDS && tests < 100) {
+            random_n(rand, bits, N);
+            mpz_setbit(N, 0);
+            // Skip N with small factors, those don't survive the sieve.
+            if (mpz_gcd_ui(NULL, N, 3 * 5 * 7 * 11 * 13 * 17 * 19 * 23) != 1) continue;
+
+            auto t0 = std::chrono::steady_clock::now();
+            int result = mpz_probab_prime_p(N, 25);
+            double seconds = seconds_since(t0);
+            // Only composites are timed (every interior point is one).
+            if (result == 0) {
+                total += seconds;
+                tests++;
+            }
+        }
+
+        mpz_clear(N);
+        gmp_randclear(rand);
+        return tests ? total / tests : 0;
+    }
+
+    double measure_sieve(uint32_t bits) {
+        gmp_randstate_t rand;
+        gmp_randinit_default(rand);
+        mpz_t N;
+        mpz_init(N);
+        random_n(rand, bits, N);
+
+        // Increase limit until the large prime loop takes long enough to time.
+        sieve_util::SieveStats stats;
+        for (uint64_t limit = 1 << 20; limit <= sieve_util::MAX_LIMIT; limit *= 4) {
+            stats = {};
+            size_t prime_count;
+            sieve_util::sieve_odds(N, 1000, limit, prime_count, 1, &stats);
+            if (stats.large_seconds >= MIN_MEASURE_SECONDS) break;
+        }
+
+        mpz_clear(N);
+        gmp_randclear(rand);
+        if (stats.large_primes == 0 || stats.large_seconds <= 0) return 0;
+        return stats.large_primes / stats.large_seconds;
+    }
+
+    uint64_t optimal_sievelimit(double gap, const Costs &costs) {
+        auto expected_seconds = [&](double limit) {
+            double log_limit = log(limit);
+            double sieve = limit / log_limit / costs.primes_per_sec;
+            double prp = gap / (1.7811 * log_limit) * costs.prp_seconds;
+            return sieve + prp;
+        };
+
+        // Cost is flat near the minimum, 1% steps are plenty.
+        double best = 1000;
+        for (double limit = best; limit <= sieve_util::MAX_LIMIT; limit *= 1.01) {
+            if (expected_seconds(limit) < expected_seconds(best)) {
+                best = limit;
+            }
+        }
+        return best;
+    }
+}
@@ -0,0 +1,57 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace autotune {
+    /**
+     * Measured costs on this machine for N of some size, used to pick the
+     * sieve limit that minimizes sieve time + PRP time of the survivors.
+     */
+    struct Costs {
+        // One PRP test of a composite the size of N
+        double prp_seconds;
+        // Large primes sieved per second (N mod p and at most one mark each)
+        double primes_per_sec;
+    };
+
+    // $PRIMEGAPVERIFY_COSTS, else ~/.cache/primegapverify_costs.txt
+    std::string default_cache_path();
+
+    /**
+     * Costs for (backend, bits) from the cache at path, measured (and added to
+     * the cache) if missing. measure_prp times one PRP test for the backend,
+     * if not given the backend must be "gmp" (mpz_probab_prime_p).
+     * Empty path disables the cache. Returns false for bits < 64 or if the
+     * costs couldn't be measured.
+     */
+    bool get_costs(const std::string &path, const std::string &backend, uint32_t bits,
+                   Costs &costs, const std::function<double()> &measure_prp = nullptr);
+
+    // Seconds for one mpz_probab_prime_p of a composite (without small factors) of bits.
+    double measure_gmp_prp(uint32_t bits);
+
+    // Primes per second in sieve_util's large prime loop for N of bits.
+    double measure_sieve(uint32_t bits);
+
+    /**
+     * Limit minimizing pi(limit) / primes_per_sec + survivors(limit) * prp_seconds
+     * with survivors(limit) ~= gap / (1.7811 * ln(limit)) (Mertens' third theorem).
+     */
+    uint64_t optimal_sievelimit(double gap, const Costs &costs);
+}
@@ -0,0 +1,353 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "certificate.hpp"
+#include "parsenumber.hpp"
+#include "primes.hpp"
+#include "residue.hpp"
+#include "sieve_util.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include <gmp.h>
+
+namespace certificate {
+    namespace {
+        const char MAGIC[9] = "PGVCERT1";
+
+        // Factors at least this large skip the batched residues (RemainderTree
+        // needs moduli < 2^40 and standard form N uses 2 * factor).
+        const uint64_t MAX_BATCH_FACTOR = 1ULL << 39;
+
+        // Bounds the allocations of a corrupt file.
+        const uint64_t MAX_GAP = 1ULL << 40;
+
+        bool parse(const std::string &N_str, mpz_t &N, residue::Primorial &form, bool &has_form) {
+            has_form = false;
+            if (mpz_set_str(N, N_str.c_str(), 10) == 0) {
+                return mpz_sgn(N) >= 0;
+            }
+            has_form = parsenumber::parse_primorial_standard_form(N_str, form) && form.value(N);
+            return has_form;
+        }
+
+        // Reads a line without the trailing newline.
+        bool read_line(FILE *f, std::string &line) {
+            char *buffer = nullptr;
+            size_t size = 0;
+            ssize_t length = getline(&buffer, &size, f);
+            if (length >= 0) {
+                line.assign(buffer, length);
+                if (!line.empty() && line.back() == '\n') line.pop_back();
+            }
+            free(buffer);
+            return length >= 0;
+        }
+
+        // Is N + offset (N < 2^64 if N_small) equal to value.
+        bool equals(bool N_small, uint64_t N_low, uint64_t offset, uint64_t value) {
+            return N_small && (unsigned __int128) N_low + offset == value;
+        }
+
+        /**
+         * Checks the claims in factors[order[start:stop]] (order groups equal
+         * factors), returns the smallest failed offset or UINT64_MAX.
+         */
+        uint64_t check_claims(const mpz_t &N, const residue::Primorial *form,
+                              const std::vector<std::pair<uint64_t, uint64_t>> &factors,
+                              const std::vector<size_t> &order, size_t start, size_t stop) {
+            uint64_t failed = UINT64_MAX;
+            mpz_t temp;
+            mpz_init(temp);
+
+            // Claims that can't use the batch are rare, test N + offset directly.
+            auto check_direct = [&](const std::pair<uint64_t, uint64_t> &claim) {
+                mpz_add_ui(temp, N, claim.first);
+                if (!mpz_divisible_ui_p(temp, claim.second)) {
+                    failed = std::min(failed, claim.first);
+                }
+            };
+
+            // PrimorialMod assumes factors <= P are prime, a composite one uses check_direct.
+            uint64_t last_f = 0;
+            bool last_batchable = false;
+            auto batchable = [&](uint64_t f) {
+                if (f != last_f) {
+                    last_f = f;
+                    last_batchable = (f & 1) && f < MAX_BATCH_FACTOR &&
+                                     (!form || f > form->P || primes::isprime_brute(f));
+                }
+                return last_batchable;
+            };
+
+            auto residues = residue::make_residues(N, form);
+            const size_t batch = residues->batch_size();
+            std::vector<uint64_t> moduli;
+            std::vector<uint64_t> mod_N(batch);
+            // Claims order[group_start[g]:group_start[g+1]] have factor moduli[g].
+            std::vector<size_t> group_start;
+
+            size_t i = start;
+            while (i < stop) {
+                moduli.clear();
+                group_start.clear();
+                while (i < stop) {
+                    const auto &claim = factors[order[i]];
+                    if (!batchable(claim.second)) {
+                        check_direct(claim);
+                        i++;
+                        continue;
+                    }
+                    uint64_t modulus = form ? 2 * claim.second : claim.second;
+                    if (moduli.empty() || moduli.back() != modulus) {
+                        if (moduli.size() == batch) break;
+                        moduli.push_back(modulus);
+                        group_start.push_back(i);
+                    }
+                    i++;
+                }
+                group_start.push_back(i);
+                if (moduli.empty()) continue;
+                residues->mod(moduli.data(), moduli.size(), mod_N.data());
+
+                for (size_t g = 0; g < moduli.size(); g++) {
+                    const uint64_t f = factors[order[group_start[g]]].second;
+                    const uint64_t r = mod_N[g] % f;
+                    for (size_t k = group_start[g]; k < group_start[g + 1]; k++) {
+                        const auto &claim = factors[order[k]];
+                        // Skips claims check_direct handled.
+                        if (claim.second != f) continue;
+                        if ((r + claim.first % f) % f != 0) {
+                            failed = std::min(failed, claim.first);
+                        }
+                    }
+                }
+            }
+            mpz_clear(temp);
+            return failed;
+        }
+    }
+
+    bool save(const std::string &path, const Certificate &cert) {
+        std::string tmp = path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "w");
+        if (f == nullptr) return false;
+
+        bool success = fprintf(f, "%s\nN %s\ngap %" PRIu64 "\nprp %zu\n",
+                               MAGIC, cert.N.c_str(), cert.gap, cert.prp.size()) > 0;
+        for (uint64_t offset : cert.prp) {
+            success &= fprintf(f, "%" PRIu64 "\n", offset) > 0;
+        }
+        success &= fprintf(f, "factors %zu\n", cert.factors.size()) > 0;
+        for (const auto &claim : cert.factors) {
+            success &= fprintf(f, "%" PRIu64 " %" PRIu64 "\n", claim.first, claim.second) > 0;
+        }
+
+        success &= fclose(f) == 0;
+        return success && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    bool load(const std::string &path, Certificate &cert) {
+        FILE *f = fopen(path.c_str(), "r");
+        if (f == nullptr) return false;
+
+        std::string line;
+        size_t count = 0;
+        bool success =
+            read_line(f, line) && line == MAGIC &&
+            read_line(f, line) && line.compare(0, 2, "N ") == 0 &&
+            fscanf(f, "gap %" SCNu64 " prp %zu", &cert.gap, &count) == 2 &&
+            cert.gap < MAX_GAP && count <= cert.gap + 1;
+        cert.N = success ? line.substr(2) : "";
+
+        cert.prp.resize(success ? count : 0);
+        for (size_t i = 0; success && i < count; i++) {
+            success = fscanf(f, "%" SCNu64, &cert.prp[i]) == 1;
+        }
+
+        success = success && fscanf(f, " factors %zu", &count) == 1 && count <= cert.gap;
+        cert.factors.resize(success ? count : 0);
+        for (size_t i = 0; success && i < count; i++) {
+            success = fscanf(f, "%" SCNu64 " %" SCNu64,
+                             &cert.factors[i].first, &cert.factors[i].second) == 2;
+        }
+
+        fclose(f);
+        return success;
+    }
+
+    bool parse_N(const std::string &N_str, mpz_t &N) {
+        residue::Primorial form;
+        bool has_form;
+        return parse(N_str, N, form, has_form);
+    }
+
+    prp::GapResult generate(const std::string &N_str, uint64_t gap, uint64_t limit, int threads,
+                            Certificate &cert) {
+        prp::GapResult result = {false, gap + 1, 0};
+        mpz_t N;
+        mpz_init(N);
+        residue::Primorial form;
+        bool has_form;
+        if (!parse(N_str, N, form, has_form)) {
+            mpz_clear(N);
+            return result;
+        }
+
+        size_t prime_count;
+        auto factors = has_form
+            ? sieve_util::sieve_factors(form, gap, limit, prime_count, threads)
+            : sieve_util::sieve_factors(N, gap, limit, prime_count, threads);
+        if (factors.empty()) {
+            mpz_clear(N);
+            return result;
+        }
+
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        const bool N_small = mpz_sizeinbase(N, 2) <= 64;
+        const uint64_t N_low = mpz_get_ui(N);
+
+        // Endpoints and odd numbers without a (proper) factor are PRP tested.
+        std::vector<uint64_t> survivors;
+        std::vector<std::pair<uint64_t, uint64_t>> claims;
+        for (uint64_t offset = 0; offset <= gap; offset++) {
+            bool odd = (offset & 1) == first_odd;
+            bool endpoint = offset == 0 || offset == gap;
+            if (!odd && !endpoint) continue;
+
+            uint64_t f = factors[offset];
+            if (f <= 1 || equals(N_small, N_low, offset, f)) {
+                survivors.push_back(offset);
+            } else if (!endpoint) {
+                claims.emplace_back(offset, f);
+            }
+        }
+
+        result = prp::test_gap(N, gap, survivors, threads);
+        mpz_clear(N);
+        if (result.verified) {
+            cert.N = N_str;
+            cert.gap = gap;
+            cert.prp = std::move(survivors);
+            cert.factors = std::move(claims);
+        }
+        return result;
+    }
+
+    CheckResult check(const Certificate &cert, int threads, bool prp_interior) {
+        const uint64_t gap = cert.gap;
+        CheckResult result = {false, gap + 1, "", 0};
+
+        mpz_t N;
+        mpz_init(N);
+        residue::Primorial form;
+        bool has_form;
+        if (!parse(cert.N, N, form, has_form)) {
+            mpz_clear(N);
+            result.reason = "N isn't a number";
+            return result;
+        }
+
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        const bool N_small = mpz_sizeinbase(N, 2) <= 64;
+        const uint64_t N_low = mpz_get_ui(N);
+
+        const auto &prp = cert.prp;
+        if (prp.empty() || prp.front() != 0 || prp.back() != gap ||
+                std::adjacent_find(prp.begin(), prp.end(), std::greater_equal<uint64_t>()) != prp.end()) {
+            mpz_clear(N);
+            result.reason = "prp offsets must be ascending and include both endpoints";
+            return result;
+        }
+
+        // Every odd number in the interior has a claim or was PRP tested.
+        const auto &factors = cert.factors;
+        size_t i = 0, j = 1;
+        for (uint64_t offset = 2 - first_odd; offset < gap; offset += 2) {
+            while (j < prp.size() && prp[j] < offset) j++;
+            if (i < factors.size() && factors[i].first == offset) {
+                const uint64_t f = factors[i].second;
+                if (f <= 1 || equals(N_small, N_low, offset, f)) {
+                    result.failed_offset = offset;
+                    result.reason = "factor isn't a proper divisor";
+                    break;
+                }
+                i++;
+            } else if (j < prp.size() && prp[j] == offset) {
+                j++;
+            } else {
+                result.failed_offset = offset;
+                result.reason = "odd offset has no factor and wasn't PRP tested";
+                break;
+            }
+        }
+        if (!result.reason[0] && i != factors.size()) {
+            result.failed_offset = factors[i].first;
+            result.reason = "factor offsets must be ascending odd numbers in the interior";
+        }
+        if (result.reason[0]) {
+            mpz_clear(N);
+            return result;
+        }
+
+        // Claims sorted by factor so each distinct factor is reduced once.
+        std::vector<size_t> order(factors.size());
+        for (size_t k = 0; k < order.size(); k++) order[k] = k;
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return factors[a].second < factors[b].second;
+        });
+
+        threads = std::max<int>(1, std::min<size_t>(threads, order.size() / 1024 + 1));
+        std::vector<uint64_t> failed(threads, UINT64_MAX);
+        const residue::Primorial *form_ptr = has_form ? &form : nullptr;
+        auto work = [&](int t) {
+            failed[t] = check_claims(N, form_ptr, factors, order,
+                                     order.size() * t / threads, order.size() * (t + 1) / threads);
+        };
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) {
+            workers.emplace_back(work, t);
+        }
+        work(0);
+        for (auto &w : workers) w.join();
+
+        uint64_t first_failed = *std::min_element(failed.begin(), failed.end());
+        if (first_failed != UINT64_MAX) {
+            mpz_clear(N);
+            result.failed_offset = first_failed;
+            result.reason = "factor doesn't divide N + offset";
+            return result;
+        }
+
+        // A listed offset isn't evidence, each one is shown composite here.
+        prp::GapResult gap_result = prp::test_gap(N, gap, prp, threads, 25, nullptr, nullptr,
+                                                  !prp_interior);
+        mpz_clear(N);
+        result.prp_tests = gap_result.tests;
+        if (!gap_result.verified) {
+            bool endpoint = gap_result.failed_offset == 0 || gap_result.failed_offset == gap;
+            result.failed_offset = gap_result.failed_offset;
+            result.reason = endpoint ? "endpoint isn't prime" : "PRP tested offset isn't composite";
+            return result;
+        }
+        result.valid = true;
+        return result;
+    }
+}
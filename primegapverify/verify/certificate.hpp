@@ -0,0 +1,80 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gmp.h>
+
+#include "prp.hpp"
+
+namespace certificate {
+    /**
+     * Evidence that [N, N + gap] is a prime gap, re-checked without sieving.
+     *
+     * On disk as text, "PGVCERT1", "N <N>", "gap <gap>", "prp <count>" then one
+     * offset per line, "factors <count>" then "<offset> <factor>" per line.
+     * N is decimal or standard form (m * P# / d + a).
+     */
+    struct Certificate {
+        std::string N;
+        uint64_t gap;
+        // Ascending offsets that were PRP tested: the endpoints and every interior
+        // survivor of the sieve.
+        std::vector<uint64_t> prp;
+        // Ascending (offset, factor) for the other odd N + offset in the interior,
+        // even numbers are implicitly divisible by 2.
+        std::vector<std::pair<uint64_t, uint64_t>> factors;
+    };
+
+    // Written to path.tmp then renamed over path.
+    bool save(const std::string &path, const Certificate &cert);
+    bool load(const std::string &path, Certificate &cert);
+
+    // Sets N from decimal or standard form, returns false if it's neither.
+    bool parse_N(const std::string &N_str, mpz_t &N);
+
+    /**
+     * Sieves [N, N + gap] for factors up to limit and PRP tests the survivors
+     * (with threads). cert is filled if the result is verified.
+     * Returns verified = false with failed_offset = gap + 1 if N_str can't be parsed.
+     */
+    prp::GapResult generate(const std::string &N_str, uint64_t gap, uint64_t limit, int threads,
+                            Certificate &cert);
+
+    struct CheckResult {
+        bool valid;
+        // Offset of the first failed claim, gap + 1 if the certificate is malformed.
+        uint64_t failed_offset;
+        const char *reason;
+        size_t prp_tests;
+    };
+
+    /**
+     * Verifies every factor claim (over threads), that claims and prp offsets
+     * cover all odd numbers in the interior, PRP tests the endpoints and shows
+     * each interior prp offset is composite with one base 2 Fermat test.
+     * With prp_interior the interior is retested with 25 reps instead, this
+     * costs as much as the original PRP run.
+     *
+     * Each distinct factor costs one residue of N (batched with residue::BatchMod,
+     * or from the parts of a standard form N), claims with factors too large for
+     * a batch use mpz_divisible_ui_p.
+     */
+    CheckResult check(const Certificate &cert, int threads, bool prp_interior = false);
+}
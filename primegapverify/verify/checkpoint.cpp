@@ -0,0 +1,210 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "checkpoint.hpp"
+#include "sieve_util.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <gmp.h>
+
+namespace checkpoint {
+    namespace {
+        const char MAGIC[9] = "PGVCKPT2";
+
+        std::vector<uint8_t> to_bits(const std::vector<char> &flags) {
+            std::vector<uint8_t> bits((flags.size() + 7) / 8, 0);
+            for (size_t i = 0; i < flags.size(); i++) {
+                bits[i / 8] |= (flags[i] != 0) << (i % 8);
+            }
+            return bits;
+        }
+
+        void from_bits(const std::vector<uint8_t> &bits, std::vector<char> &flags) {
+            for (size_t i = 0; i < flags.size(); i++) {
+                flags[i] = (bits[i / 8] >> (i % 8)) & 1;
+            }
+        }
+
+        // Little endian regardless of the host so files can move between machines.
+        bool write_u64(FILE *f, uint64_t value) {
+            uint8_t bytes[8];
+            for (int i = 0; i < 8; i++) bytes[i] = value >> (8 * i);
+            return fwrite(bytes, sizeof(bytes), 1, f) == 1;
+        }
+
+        bool read_u64(FILE *f, uint64_t &value) {
+            uint8_t bytes[8];
+            if (fread(bytes, sizeof(bytes), 1, f) != 1) return false;
+            value = 0;
+            for (int i = 0; i < 8; i++) value |= (uint64_t) bytes[i] << (8 * i);
+            return true;
+        }
+    }
+
+    bool save(const std::string &path, const State &state) {
+        std::string tmp = path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (f == nullptr) return false;
+
+        auto composite = to_bits(state.composite);
+        auto tested = to_bits(state.tested);
+        bool success =
+            fwrite(MAGIC, 8, 1, f) == 1 &&
+            write_u64(f, state.gap) &&
+            write_u64(f, state.limit) &&
+            write_u64(f, state.last_prime) &&
+            write_u64(f, state.prime_count) &&
+            write_u64(f, state.N.size()) &&
+            fwrite(state.N.data(), 1, state.N.size(), f) == state.N.size() &&
+            write_u64(f, state.composite.size()) &&
+            fwrite(composite.data(), 1, composite.size(), f) == composite.size() &&
+            fwrite(tested.data(), 1, tested.size(), f) == tested.size();
+
+        success &= fclose(f) == 0;
+        return success && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    bool load(const std::string &path, State &state) {
+        FILE *f = fopen(path.c_str(), "rb");
+        if (f == nullptr) return false;
+
+        char magic[8];
+        uint64_t N_size, odds;
+        bool success =
+            fread(magic, 8, 1, f) == 1 && memcmp(magic, MAGIC, 8) == 0 &&
+            read_u64(f, state.gap) &&
+            read_u64(f, state.limit) &&
+            read_u64(f, state.last_prime) &&
+            read_u64(f, state.prime_count) &&
+            read_u64(f, N_size) && 0 < N_size && N_size < (1ul << 30);
+
+        if (success) {
+            state.N.resize(N_size);
+            success = fread(&state.N[0], 1, N_size, f) == N_size && read_u64(f, odds);
+        }
+
+        if (success) {
+            // Same as sieve_util::odd_count, N's parity is that of its last hex digit.
+            const char last = state.N.back();
+            const uint64_t first_odd = last != '\0' && strchr("13579bdf", last) ? 0 : 1;
+            success = odds == (first_odd <= state.gap ? (state.gap - first_odd) / 2 + 1 : 0);
+        }
+
+        if (success) {
+            std::vector<uint8_t> composite((odds + 7) / 8), tested((odds + 7) / 8);
+            success = fread(composite.data(), 1, composite.size(), f) == composite.size() &&
+                fread(tested.data(), 1, tested.size(), f) == tested.size();
+            state.composite.resize(odds);
+            state.tested.resize(odds);
+            from_bits(composite, state.composite);
+            from_bits(tested, state.tested);
+        }
+
+        fclose(f);
+        return success;
+    }
+
+    Checkpointer::Checkpointer(const std::string &path, double seconds,
+                               const mpz_t &N, uint64_t gap, uint64_t limit)
+            : path(path), seconds(seconds), last_save(std::chrono::steady_clock::now()) {
+        char *N_hex = mpz_get_str(nullptr, 16, N);
+        std::string N_str = N_hex;
+        void (*free_func)(void *, size_t);
+        mp_get_memory_functions(nullptr, nullptr, &free_func);
+        free_func(N_hex, strlen(N_hex) + 1);
+
+        mpz_t temp;
+        mpz_init_set(temp, N);
+        const uint64_t odds = sieve_util::odd_count(temp, gap);
+        mpz_clear(temp);
+
+        if (!path.empty() && load(path, state)) {
+            if (state.N == N_str && state.gap == gap && state.limit == limit &&
+                    state.composite.size() == odds) {
+                resumed = true;
+                return;
+            }
+            fprintf(stderr, "checkpoint %s is for a different interval, ignoring\n", path.c_str());
+        }
+
+        state = {N_str, gap, limit, 0, 0, {}, {}};
+        state.composite.resize(odds);
+        state.tested.resize(odds);
+    }
+
+    void Checkpointer::maybe_save(bool force) {
+        if (path.empty()) return;
+
+        auto now = std::chrono::steady_clock::now();
+        if (force || std::chrono::duration<double>(now - last_save).count() >= seconds) {
+            if (!save(path, state)) {
+                fprintf(stderr, "failed to save checkpoint %s\n", path.c_str());
+            }
+            last_save = now;
+        }
+    }
+
+    bool Checkpointer::sieve(mpz_t &N, const residue::Primorial *form, size_t &prime_count,
+                             int threads, sieve_util::SieveStats *stats) {
+        if (resumed) {
+            fprintf(stderr, "resuming sieve after %lu\n", state.last_prime);
+        }
+        // sieve_odds continues counting from prime_count when resuming.
+        prime_count = state.prime_count;
+        auto on_progress = [this, &prime_count](uint64_t last_prime) {
+            state.last_prime = last_prime;
+            state.prime_count = prime_count;
+            maybe_save();
+        };
+        bool success = form ?
+            sieve_util::sieve_odds(*form, state.gap, state.limit, prime_count,
+                                   state.composite.data(), state.last_prime, on_progress,
+                                   threads, stats) :
+            sieve_util::sieve_odds(N, state.gap, state.limit, prime_count,
+                                   state.composite.data(), state.last_prime, on_progress,
+                                   threads, stats);
+        if (success) {
+            maybe_save(true);
+        }
+        return success;
+    }
+
+    prp::GapResult Checkpointer::test_gap(const mpz_t &N, int threads) {
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        std::vector<uint64_t> offsets;
+        if (mpz_cmp_ui(N, 2) == 0) {
+            offsets.push_back(0);  // The only even prime
+        }
+        for (uint64_t i = 0; i < state.composite.size(); i++) {
+            if (!state.composite[i]) {
+                offsets.push_back(first_odd + 2 * i);
+            }
+        }
+
+        auto is_tested = [&](uint64_t offset) {
+            return (offset & 1) == first_odd && state.tested[offset >> 1];
+        };
+        auto on_tested = [&](uint64_t offset) {
+            if ((offset & 1) == first_odd) {
+                state.tested[offset >> 1] = 1;
+                maybe_save();
+            }
+        };
+        auto result = prp::test_gap(N, state.gap, offsets, threads, 25, is_tested, on_tested);
+        maybe_save(true);
+        return result;
+    }
+}
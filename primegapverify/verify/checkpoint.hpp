@@ -0,0 +1,84 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gmp.h>
+
+#include "prp.hpp"
+#include "residue.hpp"
+#include "sieve_util.hpp"
+
+namespace checkpoint {
+    /**
+     * Progress of sieving and PRP testing the odd numbers in [N, N + gap].
+     *
+     * On disk as "PGVCKPT2", gap, limit, last_prime, prime_count, length of N
+     * in hex, N in hex, number of odds, then composite and tested as bitmaps
+     * (entry i is bit i % 8 of byte i / 8). Integers are 64 bit little endian.
+     */
+    struct State {
+        // hex string of N, identifies the interval.
+        std::string N;
+        uint64_t gap;
+        uint64_t limit;
+        // Every prime <= last_prime has been sieved, 0 before any.
+        uint64_t last_prime;
+        // Primes sieved so far (all those <= last_prime).
+        uint64_t prime_count;
+        // One per odd number, entry i is N + (N even) + 2*i.
+        std::vector<char> composite;
+        // Odd entries that passed PRP testing (prime endpoint or composite interior).
+        std::vector<char> tested;
+    };
+
+    // Written to path.tmp then renamed over path so a crash never leaves a partial file.
+    bool save(const std::string &path, const State &state);
+    // Fails if the file is malformed or its number of odds doesn't match N and gap.
+    bool load(const std::string &path, State &state);
+
+    /**
+     * Holds the State for one interval, resumed from path if the file there is
+     * for the same (N, gap, limit). Empty path disables saving.
+     */
+    class Checkpointer {
+        public:
+            Checkpointer(const std::string &path, double seconds,
+                         const mpz_t &N, uint64_t gap, uint64_t limit);
+
+            // Saves if seconds have passed since the last save (or force).
+            void maybe_save(bool force = false);
+
+            // sieve_util::sieve_odds (from form if given) continuing from state,
+            // prime_count includes the primes sieved before resuming.
+            bool sieve(mpz_t &N, const residue::Primorial *form, size_t &prime_count,
+                       int threads, sieve_util::SieveStats *stats = nullptr);
+
+            // prp::test_gap of the unknowns in state skipping those already tested.
+            prp::GapResult test_gap(const mpz_t &N, int threads);
+
+            State state;
+            bool resumed = false;
+
+        private:
+            const std::string path;
+            const double seconds;
+            std::chrono::steady_clock::time_point last_save;
+    };
+}
@@ -0,0 +1,123 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "parsenumber.hpp"
+
+#include <cctype>
+#include <cstdint>
+#include <string>
+
+#include <gmp.h>
+
+namespace parsenumber {
+    namespace {
+        // Reads digits at str[pos] into value.
+        bool parse_uint(const std::string &str, size_t &pos, uint64_t &value) {
+            size_t start = pos;
+            value = 0;
+            for (; pos < str.size() && isdigit(str[pos]); pos++) {
+                uint64_t digit = str[pos] - '0';
+                if (value > (UINT64_MAX - digit) / 10) return false;
+                value = value * 10 + digit;
+            }
+            return pos > start;
+        }
+
+        bool consume(const std::string &str, size_t &pos, char c) {
+            if (pos < str.size() && str[pos] == c) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        // Product of primes <= k
+        bool primorial(uint64_t k, uint64_t &result) {
+            if (k > 100) return false;
+            mpz_t temp;
+            mpz_init(temp);
+            mpz_primorial_ui(temp, k);
+            bool fits = mpz_fits_ulong_p(temp);
+            result = mpz_get_ui(temp);
+            mpz_clear(temp);
+            return fits;
+        }
+    }
+
+    bool parse_primorial_standard_form(const std::string &input, residue::Primorial &form) {
+        // Remove all spaces
+        std::string str;
+        for (char c : input) {
+            if (!isspace(c)) str.push_back(c);
+        }
+
+        size_t pos = 0;
+
+        // [m *] [(] P # [)]
+        uint64_t first;
+        bool open = consume(str, pos, '(');
+        if (!parse_uint(str, pos, first)) return false;
+        bool has_m = !open && consume(str, pos, '*');
+        if (has_m) {
+            open = consume(str, pos, '(');
+            if (!parse_uint(str, pos, form.P)) return false;
+            form.m = first;
+        } else {
+            form.P = first;
+            form.m = 1;
+        }
+        if (!consume(str, pos, '#')) return false;
+        bool parens = consume(str, pos, ')') || open;
+
+        // [/ d | / d# | / (d1 * d2) | / (d1# * d2)]
+        enum { NONE, PLAIN, PRIMORIAL, PAIR } d_kind = NONE;
+        form.d = 1;
+        if (consume(str, pos, '/')) {
+            if (consume(str, pos, '(')) {
+                uint64_t d1, d2;
+                if (!parse_uint(str, pos, d1)) return false;
+                if (consume(str, pos, '#') && !primorial(d1, d1)) return false;
+                if (!consume(str, pos, '*') || !parse_uint(str, pos, d2)) return false;
+                if (!consume(str, pos, ')')) return false;
+                unsigned __int128 d = (unsigned __int128) d1 * d2;
+                if (d > UINT64_MAX) return false;
+                form.d = d;
+                d_kind = PAIR;
+            } else {
+                if (!parse_uint(str, pos, form.d)) return false;
+                d_kind = PLAIN;
+                if (consume(str, pos, '#')) {
+                    if (!primorial(form.d, form.d)) return false;
+                    d_kind = PRIMORIAL;
+                }
+            }
+        }
+
+        // Same combinations as the regexes in parsenumber.py
+        if (parens) {
+            if (d_kind == NONE || d_kind == PAIR) return false;
+            if (d_kind == PRIMORIAL && has_m) return false;
+        }
+        if (d_kind == PAIR && !has_m) return false;
+
+        // +- a
+        bool negative = consume(str, pos, '-');
+        if (!negative && !consume(str, pos, '+')) return false;
+        uint64_t a;
+        if (!parse_uint(str, pos, a) || a > (uint64_t) INT64_MAX) return false;
+        form.a = negative ? -(int64_t) a : a;
+
+        return pos == str.size();
+    }
+}
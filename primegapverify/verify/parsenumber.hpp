@@ -0,0 +1,28 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <string>
+
+#include "residue.hpp"
+
+namespace parsenumber {
+    /**
+     * Port of parsenumber.parse_primorial_standard_form, accepts the same forms
+     * (m * P# / d +- a, m * P# / d# +- a, m * P# / (d1 * d2) +- a, ...).
+     * Returns false if str isn't one of them or a part doesn't fit in 64 bits.
+     */
+    bool parse_primorial_standard_form(const std::string &str, residue::Primorial &form);
+}
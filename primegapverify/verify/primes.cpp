@@ -14,10 +14,23 @@
 
 #include "primes.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace primes {
     /**
      * Cleanup version of
@@ -34,112 +47,463 @@ namespace primes {
         return true;
     }
 
-#ifdef HANDROLLED
+    /**
+     * Numbers coprime to 30 are stored 8 to a byte, byte b bit j is
+     * 30 * b + WHEEL[j]. 2, 3 and 5 are returned before the first block.
+     */
+    static const uint32_t WHEEL[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+    // WHEEL_BIT[r] is the bit for residue r mod 30 (r coprime to 30).
+    static const uint8_t WHEEL_BIT[30] = {
+        0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
+        0, 2, 0, 3, 0, 0, 0, 4, 0, 5,
+        0, 0, 0, 6, 0, 0, 0, 0, 0, 7
+    };
+
+    // COUNT_BELOW[r] is the number of WHEEL residues < r.
+    static const uint8_t COUNT_BELOW[30] = {
+        0, 0, 1, 1, 1, 1, 1, 1, 2, 2,
+        2, 2, 3, 3, 4, 4, 4, 4, 5, 5,
+        6, 6, 6, 6, 7, 7, 7, 7, 7, 7
+    };
+
+    static const uint64_t SMALL_PRIMES[3] = {2, 3, 5};
+
+    static const char TABLE_MAGIC[9] = "PGVPRIM1";
+    static const size_t TABLE_HEADER = 16;
+
+    class PrimeTable {
+        public:
+            PrimeTable(void *mapped, size_t size)
+                : mapped(mapped), size(size),
+                  bitmap((const uint8_t*) mapped + TABLE_HEADER), bytes(size - TABLE_HEADER) {}
+            ~PrimeTable() { munmap(mapped, size); }
+
+            // Does the table hold all of bitmap bytes [first, first + count).
+            bool covers(uint64_t first, uint64_t count) const { return first + count <= bytes; }
+
+        private:
+            void *mapped;
+            const size_t size;
+
+        public:
+            const uint8_t *bitmap;
+            const uint64_t bytes;
+    };
+
+    std::shared_ptr<const PrimeTable> shared_table() {
+        static std::mutex lock;
+        // Kept per path so a changed $PRIMEGAPVERIFY_PRIMES maps the new file.
+        static std::map<std::string, std::shared_ptr<const PrimeTable>> tables;
+
+        const char *path = getenv("PRIMEGAPVERIFY_PRIMES");
+        if (!path || !*path) return nullptr;
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = tables.find(path);
+        if (it != tables.end()) return it->second;
+
+        std::shared_ptr<const PrimeTable> table;
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && (size_t) st.st_size > TABLE_HEADER) {
+            void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            uint64_t bytes = 0;
+            if (mapped != MAP_FAILED) {
+                // Little endian, as write_table wrote it.
+                const uint8_t *header = (const uint8_t*) mapped;
+                for (int i = 0; i < 8; i++) bytes |= (uint64_t) header[8 + i] << (8 * i);
+                if (memcmp(mapped, TABLE_MAGIC, 8) == 0 &&
+                        bytes == (uint64_t) st.st_size - TABLE_HEADER) {
+                    table.reset(new PrimeTable(mapped, st.st_size));
+                } else {
+                    munmap(mapped, st.st_size);
+                }
+            }
+        }
+        if (fd >= 0) close(fd);
+        if (!table) {
+            fprintf(stderr, "PRIMEGAPVERIFY_PRIMES=%s isn't a prime table, ignoring it\n", path);
+        }
+        tables[path] = table;
+        return table;
+    }
+
     class PrimeIterator {
         public:
-            PrimeIterator() = default;
+            PrimeIterator() : PrimeIterator(0) {};
+            PrimeIterator(uint64_t start, std::shared_ptr<const PrimeTable> table = nullptr)
+                : table(std::move(table)) {
+                sieve.resize(BLOCK_BYTES / 8);
+                jump_to(start);
+            }
             ~PrimeIterator() = default;
 
+            void jump_to(uint64_t start) {
+                small_i = 0;
+                while (small_i < 3 && SMALL_PRIMES[small_i] < start)
+                    small_i++;
+                prev_before = start;
+
+                // Reuse the current block if it contains start
+                if (!sieved || start < B || start >= B + SPAN) {
+                    reseed(start - start % 30);
+                }
+                set_cursor(start);
+            }
+
             uint64_t next_prime() {
-                /* Ideally find a way to avoid this */
-                if (B == 1) {
-                    B = 0;
-
-                    is_prime.resize(ODD_BLOCKSIZE);
-                    sieve_next_interval();
-                    is_prime[0] = 0; // Skip 1
-                    return 2;
+                if (small_i < 3)
+                    return prev_before = SMALL_PRIMES[small_i++];
+
+                while (word == 0) {
+                    if (++word_i == sieve.size()) {
+                        B += SPAN;
+                        sieve_next_interval();
+                        word_i = 0;
+                    }
+                    word = load_word(word_i);
                 }
 
+                uint32_t bit = __builtin_ctzll(word);
+                word &= word - 1;
+                return prev_before = B + 240 * word_i + 30 * (bit >> 3) + WHEEL[bit & 7];
+            }
+
+            // Largest prime < the last prime returned (or < start), 0 if none.
+            uint64_t prev_prime() {
+                uint64_t x = prev_before;
                 while (true) {
-                    // Search current block
-                    for(; block_i < ODD_BLOCKSIZE; block_i++) {
-                        if (is_prime[block_i]) {
-                            //return B + 2 * block_i + 1;
-                            // Set for next
-                            block_i++;
-                            return B + 2 * block_i - 1;
-                        }
+                    if (x <= 7) {
+                        // No wheel primes < 7
+                        uint32_t i = 3;
+                        while (i > 0 && SMALL_PRIMES[i-1] >= x) i--;
+                        if (i == 0)
+                            return 0;
+
+                        small_i = i;
+                        prev_before = SMALL_PRIMES[i-1];
+                        if (B != 0) reseed(0);
+                        set_cursor(7);
+                        return prev_before;
+                    }
+
+                    if (x <= B || x > B + SPAN) {
+                        // Sieve the block ending at x
+                        reseed(x <= SPAN ? 0 : (x - SPAN + 29) / 30 * 30);
                     }
 
-                    B += BLOCKSIZE;
-                    sieve_next_interval();
-                    block_i = 0;
+                    uint64_t end = bit_index(x);
+                    while (end > 0) {
+                        size_t wi = (end - 1) / 64;
+                        uint32_t bits = end - 64 * wi;
+                        uint64_t w = load_word(wi);
+                        if (bits < 64) w &= (1ull << bits) - 1;
+                        if (w) {
+                            uint64_t i = 64 * wi + 63 - __builtin_clzll(w);
+                            small_i = 3;
+                            prev_before = B + 30 * (i >> 3) + WHEEL[i & 7];
+                            set_cursor(prev_before + 1);
+                            return prev_before;
+                        }
+                        end = 64 * wi;
+                    }
+                    x = B;
                 }
             }
 
         private:
+            uint64_t load_word(size_t i) const {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                // Byte 0 must be the low bits so ctz finds the smallest number.
+                return __builtin_bswap64(sieve[i]);
+#else
+                return sieve[i];
+#endif
+            }
+
+            // Index of the first bit representing a number >= x, x in [B, B + SPAN].
+            uint64_t bit_index(uint64_t x) const {
+                uint64_t offset = x - B;
+                return 8 * (offset / 30) + COUNT_BELOW[offset % 30];
+            }
+
+            // next_prime() continues from the first number >= x.
+            void set_cursor(uint64_t x) {
+                uint64_t i = bit_index(x);
+                word_i = i / 64;
+                if (word_i == sieve.size()) {
+                    word_i--;
+                    word = 0;
+                } else {
+                    word = load_word(word_i) & (~0ull << (i % 64));
+                }
+            }
+
+            // Start sieving from an arbitrary (multiple of 30) B.
+            void reseed(uint64_t new_B) {
+                assert(new_B % 30 == 0);
+                B = new_B;
+                seeded = 0;
+                next_byte.clear();
+                buckets.clear();
+                sieve_next_interval();
+                sieved = true;
+            }
+
             void sieve_next_interval() {
-                uint64_t B_END = B + BLOCKSIZE - 1;
+                // Copy from the table while it covers the block, state for
+                // sieving is rebuilt from B after leaving it.
+                if (table && table->covers(B / 30, BLOCK_BYTES)) {
+                    memcpy(sieve.data(), table->bitmap + B / 30, BLOCK_BYTES);
+                    from_table = true;
+                    return;
+                }
+                if (from_table) {
+                    from_table = false;
+                    seeded = 0;
+                    next_byte.clear();
+                    buckets.clear();
+                }
+
+                uint64_t B_END = B + SPAN - 1;
 
                 // Make sure enough primes for B_END
                 while (true) {
-                    uint64_t lastp = primes.empty() ? 0 : primes.back();
-                    if (lastp * lastp > B_END) break;
-
-                    // Find a next prime via brute force.
-                    uint64_t nextp = lastp == 0 ? 3 : lastp + 2;
-                    for (; ; nextp += 2) {
-                        bool isp = true;
-                        for (uint32_t p : primes) {
-                            if (nextp % p == 0) {
-                                isp = false;
-                                break;
+                    if (seeded == primes.size()) {
+                        uint64_t lastp = primes.empty() ? 0 : primes.back();
+                        if (lastp * lastp > B_END) break;
+
+                        // Find a next prime via brute force.
+                        uint64_t nextp = lastp == 0 ? 7 : lastp + 2;
+                        for (; ; nextp += 2) {
+                            if (nextp % 3 == 0 || nextp % 5 == 0)
+                                continue;
+                            bool isp = true;
+                            for (uint32_t p : primes) {
+                                if ((uint64_t) p * p > nextp) break;
+                                if (nextp % p == 0) {
+                                    isp = false;
+                                    break;
+                                }
                             }
+                            if (isp) break;
                         }
-                        if (isp) break;
+                        primes.push_back(nextp);
                     }
 
-                    primes.push_back(nextp);
-                    if (B == 0) {
-                        next_mod.push_back(nextp * nextp >> 1);
+                    // Primes are kept after a reseed but only sieve once needed.
+                    const uint64_t nextp = primes[seeded];
+                    if (nextp * nextp > B_END) break;
+                    seeded++;
+
+                    // First multiple of nextp >= max(nextp^2, B) for each wheel class.
+                    uint64_t k0 = std::max(nextp, (B + nextp - 1) / nextp);
+                    std::array<uint32_t, 8> first;
+                    for (uint32_t j = 0; j < 8; j++) {
+                        uint64_t k = k0 + (WHEEL[j] + 30 - k0 % 30) % 30;
+                        first[j] = (nextp * k - B) / 30;
+                    }
+
+                    if (nextp < BLOCK_BYTES) {
+                        next_byte.push_back(first);
                     } else {
-                        // Next odd multiple of nextp >= B
-                        uint64_t mult = (B-1) / nextp + 1;
-                        uint64_t first = (mult | 1) * nextp;
-                        assert( first >= B );
-                        assert( first / nextp % 2 == 1 );
-                        first -= B;
-                        next_mod.push_back(first >> 1);
+                        for (uint32_t j = 0; j < 8; j++)
+                            add_to_bucket(first[j] / BLOCK_BYTES, nextp, j, first[j] % BLOCK_BYTES);
                     }
                 }
 
-                std::fill(is_prime.begin(), is_prime.end(), true);
+                std::fill(sieve.begin(), sieve.end(), ~0ull);
+                uint8_t *bytes = reinterpret_cast<uint8_t*>(sieve.data());
+                if (B == 0) {
+                    bytes[0] &= ~1;  // 1 is not prime
+                }
 
-                for (uint32_t pi = 0; pi < primes.size(); pi++) {
+                for (uint32_t pi = 0; pi < next_byte.size(); pi++) {
                     const uint32_t prime = primes[pi];
-                    uint32_t first = next_mod[pi];
-                    for (; first < ODD_BLOCKSIZE; first += prime){
-                        is_prime[first] = false;
+                    for (uint32_t j = 0; j < 8; j++) {
+                        // Multiples p * (WHEEL[j] + 30t) share a bit and are p bytes apart.
+                        const uint8_t mask = ~(1 << WHEEL_BIT[prime * WHEEL[j] % 30]);
+                        uint32_t first = next_byte[pi][j];
+                        for (; first < BLOCK_BYTES; first += prime) {
+                            bytes[first] &= mask;
+                        }
+                        next_byte[pi][j] = first - BLOCK_BYTES;
                     }
-                    next_mod[pi] = first - ODD_BLOCKSIZE;
                 }
+
+                if (buckets.empty())
+                    return;
+
+                // Large primes hit each wheel class at most once per block,
+                // only visit the ones in this block's bucket.
+                std::vector<Bucketed> current = std::move(buckets.front());
+                buckets.pop_front();
+                for (const auto &entry : current) {
+                    uint32_t j = entry.offset_class >> 29;
+                    uint32_t offset = entry.offset_class & OFFSET_MASK;
+                    bytes[offset] &= ~(1 << WHEEL_BIT[entry.prime * WHEEL[j] % 30]);
+                    uint64_t next = offset + (uint64_t) entry.prime;
+                    // bucket 0 is now the next block.
+                    add_to_bucket(next / BLOCK_BYTES - 1, entry.prime, j, next % BLOCK_BYTES);
+                }
+                // Reuse the allocation for a later block.
+                current.clear();
+                buckets.push_back(std::move(current));
+            }
+
+            void add_to_bucket(uint64_t block, uint32_t prime, uint32_t j, uint32_t offset) {
+                while (buckets.size() <= block)
+                    buckets.emplace_back();
+                buckets[block].push_back({prime, (j << 29) | offset});
             }
 
+            // Bytes per block, each byte covers 30 numbers.
             // Large enough to be fast and still fit in L1/L2 cache.
-            const uint64_t BLOCKSIZE = 1 << 16;
-            const uint64_t ODD_BLOCKSIZE = BLOCKSIZE >> 1;
+            static const uint32_t BLOCK_BYTES = 1 << 15;
+            static const uint64_t SPAN = 30 * BLOCK_BYTES;
+            static const uint32_t OFFSET_MASK = (1 << 29) - 1;
+
+            // Next of SMALL_PRIMES to return, 3 once past them.
+            uint32_t small_i = 0;
+
+            // prev_prime() returns the largest prime < prev_before.
+            uint64_t prev_before = 0;
 
-            // Start of current block
-            uint64_t B = 1;
+            // Start of current block (multiple of 30)
+            uint64_t B = 0;
+            bool sieved = false;
 
-            // Index for current interval in is_prime
-            uint64_t block_i = 0;
-            std::vector<char> is_prime;
+            // Current word in sieve, with already returned primes cleared.
+            size_t word_i = 0;
+            uint64_t word = 0;
+            std::vector<uint64_t> sieve;
 
+            // Sieving primes (starting from 7), primes[0, seeded) are in use.
             std::vector<uint32_t> primes;
-            // First number in next block that primes[pi] divides.
-            std::vector<int32_t> next_mod;
+            size_t seeded = 0;
+            // Byte index in next block of the next multiple of primes[pi] in
+            // each wheel class. Only for primes < BLOCK_BYTES, larger primes
+            // are in buckets.
+            std::vector<std::array<uint32_t, 8>> next_byte;
+
+            // Bucket sieve (T. Oliveira e Silva) for primes >= BLOCK_BYTES.
+            // buckets[i] holds the (prime, wheel class) whose next multiple is
+            // in the i-th block from B, and that multiple's byte.
+            struct Bucketed {
+                uint32_t prime;
+                // wheel class in the top 3 bits
+                uint32_t offset_class;
+            };
+            std::deque<std::vector<Bucketed>> buckets;
+
+            std::shared_ptr<const PrimeTable> table;
+            // The current block was copied from table.
+            bool from_table = false;
     };
 
+    bool write_table(const std::string &path, uint64_t limit) {
+        const uint64_t bytes = limit / 30 + 1;
+        std::string tmp = path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (f == nullptr) return false;
+
+        uint8_t header[TABLE_HEADER];
+        memcpy(header, TABLE_MAGIC, 8);
+        for (int i = 0; i < 8; i++) header[8 + i] = bytes >> (8 * i);
+        bool success = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+
+        // Sieved without a table so an old one (at path) is never copied.
+        PrimeIterator iter(7);
+        std::vector<uint8_t> chunk(1 << 20);
+        uint64_t prime = iter.next_prime();
+        for (uint64_t first = 0; success && first < bytes; first += chunk.size()) {
+            const uint64_t count = std::min<uint64_t>(chunk.size(), bytes - first);
+            std::fill(chunk.begin(), chunk.end(), 0);
+            for (; prime < 30 * (first + count); prime = iter.next_prime()) {
+                chunk[prime / 30 - first] |= 1 << WHEEL_BIT[prime % 30];
+            }
+            success = fwrite(chunk.data(), 1, count, f) == count;
+        }
+
+        success &= fclose(f) == 0;
+        return success && rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+#ifdef HANDROLLED
+
     uint64_t iterator::next() {
         return prime_iter->next_prime();
     }
 
+    uint64_t iterator::prev() {
+        return prime_iter->prev_prime();
+    }
+
+    void iterator::jump_to(uint64_t start, uint64_t stop_hint) {
+        prime_iter->jump_to(start);
+    }
+
     iterator::iterator() {
-        prime_iter.reset(new PrimeIterator());
+        prime_iter.reset(new PrimeIterator(0, shared_table()));
+    }
+    iterator::iterator(uint64_t start, uint64_t stop_hint) {
+        prime_iter.reset(new PrimeIterator(start, shared_table()));
+    }
+    iterator::~iterator() = default;
+#else
+    iterator::iterator() : table(shared_table()) {
+        select(0, UINT64_MAX);
+    }
+
+    iterator::iterator(uint64_t start, uint64_t stop_hint)
+        : prime_iter(start > 0 ? start - 1 : 0, stop_hint), start(start), table(shared_table()) {
+        select(start, stop_hint);
     }
+
     iterator::~iterator() = default;
+
+    void iterator::select(uint64_t start, uint64_t stop_hint) {
+        // Without a hint assume the table is big enough.
+        use_table = table && (stop_hint == UINT64_MAX || table->covers(stop_hint / 30, 1));
+        if (use_table) {
+            if (!table_iter) {
+                table_iter.reset(new PrimeIterator(start, table));
+            } else {
+                table_iter->jump_to(start);
+            }
+        }
+    }
+
+    void iterator::jump_to(uint64_t start, uint64_t stop_hint) {
+        select(start, stop_hint);
+        if (use_table) return;
+#if PRIMESIEVE_VERSION_MAJOR >= 8
+        prime_iter.jump_to(start > 0 ? start - 1 : 0, stop_hint);
+#else
+        prime_iter.skipto(start > 0 ? start - 1 : 0, stop_hint);
+#endif
+        this->start = start;
+        started = false;
+    }
+
+    uint64_t iterator::next() {
+        if (use_table) return table_iter->next_prime();
+        started = true;
+        uint64_t prime = prime_iter.next_prime();
+        // primesieve versions disagree on if start is inclusive.
+        while (prime < start) prime = prime_iter.next_prime();
+        return prime;
+    }
+
+    uint64_t iterator::prev() {
+        if (use_table) return table_iter->prev_prime();
+        if (!started) {
+            // Step past start so both versions agree on the prime before it.
+            next();
+        }
+        return prime_iter.prev_prime();
+    }
 #endif  // HANDROLLED
 
 }  // namespace primes
@@ -14,7 +14,9 @@
 
 #pragma once
 
-#include<memory>
+#include <cstdint>
+#include <memory>
+#include <string>
 
 #ifndef HANDROLLED
 #include <primesieve.hpp>
@@ -23,17 +25,41 @@
 
 namespace primes {
     class PrimeIterator;
+    class PrimeTable;
 
     bool isprime_brute(uint32_t n);
 
+    /**
+     * Prime table file, "PGVPRIM1" then bytes (uint64, little endian) then a
+     * bitmap of bytes bytes: bit j of byte b is set if 30 * b + WHEEL[j] is
+     * prime (WHEEL = 1, 7, 11, 13, 17, 19, 23, 29), byte b is found directly
+     * for seeking. Covers numbers < 30 * bytes, ~33MB per 10^9.
+     */
+    bool write_table(const std::string &path, uint64_t limit);
+
+    /**
+     * Table from $PRIMEGAPVERIFY_PRIMES mapped read only (shared by every
+     * iterator in the process and the page cache by every process), nullptr
+     * if unset or not a table. Iterators copy blocks from it while they are
+     * covered and sieve past its end.
+     */
+    std::shared_ptr<const PrimeTable> shared_table();
+
 #ifdef HANDROLLED
     class iterator {
         public:
             // [De]Constructor must be defined after PrimeItator is complete
             iterator();
+            // Primes >= start, stop_hint is the largest prime that will be needed.
+            iterator(uint64_t start, uint64_t stop_hint);
             ~iterator();
 
+            // Restart so next() returns primes >= start and prev() primes < start.
+            void jump_to(uint64_t start, uint64_t stop_hint);
+
             uint64_t next();
+            // Largest prime < the last returned (or < start), 0 if none.
+            uint64_t prev();
 
         private:
             std::unique_ptr<PrimeIterator> prime_iter;
@@ -42,14 +68,36 @@ namespace primes {
     // See README
     #include <primesieve.hpp>
 
+    /**
+     * primesieve, or the hand rolled iterator reading from shared_table()
+     * when one covers stop_hint (or with no stop_hint).
+     */
     class iterator {
         public:
-            iterator() = default;
-            ~iterator() = default;
+            iterator();
+            // Primes >= start, stop_hint is the largest prime that will be needed.
+            iterator(uint64_t start, uint64_t stop_hint);
+            ~iterator();
+
+            // Restart so next() returns primes >= start and prev() primes < start.
+            void jump_to(uint64_t start, uint64_t stop_hint);
+
+            uint64_t next();
+
+            // Largest prime < the last returned (or < start), 0 if none.
+            uint64_t prev();
 
-            uint64_t next() { return prime_iter.next_prime(); }
         private:
+            // Uses table_iter (from table) if it covers stop_hint.
+            void select(uint64_t start, uint64_t stop_hint);
+
             primesieve::iterator prime_iter;
+            uint64_t start = 0;
+            bool started = false;
+
+            std::shared_ptr<const PrimeTable> table;
+            std::unique_ptr<PrimeIterator> table_iter;
+            bool use_table = false;
     };
 #endif  // HANDROLLED
 }
@@ -0,0 +1,148 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "prp.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gmp.h>
+
+namespace prp {
+    namespace {
+        struct WorkQueue {
+            std::mutex lock;
+            std::deque<uint64_t> items;
+
+            // Owner takes the highest priority item.
+            bool pop(uint64_t &item) {
+                std::lock_guard<std::mutex> guard(lock);
+                if (items.empty()) return false;
+                item = items.front();
+                items.pop_front();
+                return true;
+            }
+
+            // Thieves take the lowest priority item.
+            bool steal(uint64_t &item) {
+                std::lock_guard<std::mutex> guard(lock);
+                if (items.empty()) return false;
+                item = items.back();
+                items.pop_back();
+                return true;
+            }
+        };
+    }
+
+    GapResult test_gap(const mpz_t &N, uint64_t gap, const std::vector<uint64_t> &offsets,
+                       int threads, int reps,
+                       const std::function<bool(uint64_t)> &is_tested,
+                       const std::function<void(uint64_t)> &on_tested,
+                       bool fermat_interior) {
+        GapResult result = {false, 0, 0};
+
+        // An endpoint removed by the sieve is composite.
+        if (offsets.empty() || offsets.front() != 0) {
+            return result;
+        }
+        if (offsets.back() != gap) {
+            result.failed_offset = gap;
+            return result;
+        }
+
+        // Endpoints then both ends of the interior towards the middle.
+        std::vector<uint64_t> order = {0};
+        if (gap != 0) order.push_back(gap);
+        for (size_t lo = 1, hi = offsets.size() - 1; lo < hi; ) {
+            order.push_back(offsets[lo++]);
+            if (lo < hi) order.push_back(offsets[--hi]);
+        }
+
+        if (is_tested) {
+            order.erase(std::remove_if(order.begin(), order.end(), is_tested), order.end());
+        }
+        if (order.empty()) {
+            result.verified = true;
+            return result;
+        }
+
+        threads = std::max(1, std::min<int>(threads, order.size()));
+        std::vector<WorkQueue> queues(threads);
+        for (size_t i = 0; i < order.size(); i++) {
+            queues[i % threads].items.push_back(order[i]);
+        }
+
+        std::atomic<bool> done(false);
+        std::atomic<size_t> tests(0);
+        std::mutex result_lock;
+        bool failed = false;
+
+        auto worker = [&](int t) {
+            mpz_t n, n_1, two;
+            mpz_inits(n, n_1, two, NULL);
+            mpz_set_ui(two, 2);
+            uint64_t offset;
+            while (!done) {
+                bool found = queues[t].pop(offset);
+                for (int i = 1; !found && i < threads; i++) {
+                    found = queues[(t + i) % threads].steal(offset);
+                }
+                if (!found) break;
+
+                mpz_add_ui(n, N, offset);
+                bool endpoint = offset == 0 || offset == gap;
+                bool is_prime;
+                if (fermat_interior && !endpoint && mpz_cmp_ui(n, 2) > 0) {
+                    // 2^(n-1) == 1 mod n
+                    mpz_sub_ui(n_1, n, 1);
+                    mpz_powm(n_1, two, n_1, n);
+                    is_prime = mpz_cmp_ui(n_1, 1) == 0;
+                } else {
+                    is_prime = mpz_probab_prime_p(n, reps) > 0;
+                }
+                tests++;
+
+                if (is_prime == endpoint) {
+                    if (on_tested) {
+                        std::lock_guard<std::mutex> guard(result_lock);
+                        on_tested(offset);
+                    }
+                } else {
+                    std::lock_guard<std::mutex> guard(result_lock);
+                    // Keep the first failure in priority order if several race.
+                    uint64_t rank = std::min(offset, gap - offset);
+                    if (!failed || rank < std::min(result.failed_offset, gap - result.failed_offset)) {
+                        result.failed_offset = offset;
+                    }
+                    failed = true;
+                    done = true;
+                }
+            }
+            mpz_clears(n, n_1, two, NULL);
+        };
+
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) workers.emplace_back(worker, t);
+        worker(0);
+        for (auto &w : workers) w.join();
+
+        result.verified = !failed;
+        result.tests = tests;
+        return result;
+    }
+}
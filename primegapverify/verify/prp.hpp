@@ -0,0 +1,53 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <gmp.h>
+
+namespace prp {
+    // Outcome of PRP testing the sieve survivors of [N, N + gap].
+    struct GapResult {
+        // Endpoints are prime and no interior candidate is.
+        bool verified;
+        // If an endpoint failed or an interior prime was found, its offset from N.
+        uint64_t failed_offset;
+        size_t tests;
+    };
+
+    /**
+     * Runs mpz_probab_prime_p on N + offsets[i] (ascending survivors of the
+     * sieve, endpoints included if they weren't sieved out) over threads.
+     *
+     * Endpoints are tested first then interior candidates from both ends
+     * inwards. Every worker stops as soon as the gap is known to fail.
+     * Candidates are dealt to per thread queues in that order, a thread with
+     * an empty queue steals the lowest priority item from another.
+     *
+     * For resuming, offsets where is_tested(offset) are skipped and on_tested
+     * is called (one at a time) for each offset that passes.
+     *
+     * With fermat_interior the interior only gets one base 2 Fermat test each,
+     * enough to prove a composite (a pseudoprime fails like a prime would).
+     */
+    GapResult test_gap(const mpz_t &N, uint64_t gap, const std::vector<uint64_t> &offsets,
+                       int threads, int reps = 25,
+                       const std::function<bool(uint64_t)> &is_tested = nullptr,
+                       const std::function<void(uint64_t)> &on_tested = nullptr,
+                       bool fermat_interior = false);
+}
@@ -0,0 +1,207 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* residue.cpp
+ * [1] Bernstein, "Fast multiplication and its applications" (remainder trees)
+ *    https://cr.yp.to/lineartime/multapps-20080515.pdf
+ */
+
+#include "residue.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <gmp.h>
+
+namespace residue {
+
+    RemainderTree::RemainderTree(const mpz_t &N_in) {
+        mpz_init_set(N, N_in);
+
+        // Each modulus is ~35 bits, aim for root ~ size of N.
+        size_t bits = mpz_sizeinbase(N, 2);
+        size_t wanted = std::max<size_t>(bits / 32, 4 * LEAF);
+
+        leaves = 1;
+        while (leaves * LEAF < wanted) leaves *= 2;
+        batch = leaves * LEAF;
+
+        prod.reset(new mpz_t[2 * leaves]);
+        rem.reset(new mpz_t[2 * leaves]);
+        for (size_t i = 0; i < 2 * leaves; i++) {
+            mpz_init(prod[i]);
+            mpz_init(rem[i]);
+        }
+    }
+
+    RemainderTree::~RemainderTree() {
+        for (size_t i = 0; i < 2 * leaves; i++) {
+            mpz_clear(prod[i]);
+            mpz_clear(rem[i]);
+        }
+        mpz_clear(N);
+    }
+
+    void RemainderTree::mod(const uint64_t *moduli, size_t count, uint64_t *residues) {
+        assert(count <= batch);
+
+        // Product tree, padded leaves are 1.
+        for (size_t l = 0; l < leaves; l++) {
+            mpz_t &leaf = prod[leaves + l];
+            mpz_set_ui(leaf, 1);
+            for (size_t i = l * LEAF; i < std::min(count, (l + 1) * LEAF); i++) {
+                mpz_mul_ui(leaf, leaf, moduli[i]);
+            }
+        }
+        for (size_t node = leaves - 1; node >= 1; node--) {
+            mpz_mul(prod[node], prod[2 * node], prod[2 * node + 1]);
+        }
+
+        // Remainder tree
+        mpz_tdiv_r(rem[1], N, prod[1]);
+        for (size_t node = 2; node < 2 * leaves; node++) {
+            mpz_tdiv_r(rem[node], rem[node / 2], prod[node]);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            residues[i] = mpz_fdiv_ui(rem[leaves + i / LEAF], moduli[i]);
+        }
+    }
+
+    void mod_packed(const mpz_t &N, const uint64_t *moduli, size_t count, uint64_t *residues) {
+        size_t i = 0;
+        while (i < count) {
+            // Greedily multiply moduli while product < 2^64
+            unsigned __int128 product = moduli[i];
+            size_t j = i + 1;
+            for (; j < count; j++) {
+                unsigned __int128 next = product * moduli[j];
+                if (next >> 64) break;
+                product = next;
+            }
+
+            uint64_t r = mpz_fdiv_ui(N, (uint64_t) product);
+            for (; i < j; i++) {
+                residues[i] = r % moduli[i];
+            }
+        }
+    }
+
+    BatchMod::BatchMod(const mpz_t &N_in) {
+        mpz_init_set(N, N_in);
+        if (mpz_sizeinbase(N, 2) >= TREE_MIN_BITS) {
+            tree.reset(new RemainderTree(N));
+        }
+    }
+
+    BatchMod::~BatchMod() {
+        mpz_clear(N);
+    }
+
+    void BatchMod::mod(const uint64_t *moduli, size_t count, uint64_t *residues) {
+        assert(count <= batch_size());
+        if (tree) {
+            tree->mod(moduli, count, residues);
+        } else {
+            mod_packed(N, moduli, count, residues);
+        }
+    }
+
+    bool Primorial::value(mpz_t &N) const {
+        mpz_primorial_ui(N, P);
+        if (!mpz_divisible_ui_p(N, d)) {
+            return false;
+        }
+        mpz_divexact_ui(N, N, d);
+        mpz_mul_ui(N, N, m);
+        if (a >= 0) {
+            mpz_add_ui(N, N, a);
+        } else {
+            mpz_sub_ui(N, N, -a);
+        }
+        return mpz_sgn(N) >= 0;
+    }
+
+    void Primorial::from_K(const uint64_t *moduli, const uint64_t *K_residues, size_t count,
+                           uint64_t *residues) const {
+        for (size_t i = 0; i < count; i++) {
+            const uint64_t two_q = moduli[i];
+            unsigned __int128 r = (unsigned __int128) (m % two_q) * K_residues[i];
+            uint64_t n = r % two_q;
+            if (a >= 0) {
+                n = (n + ((uint64_t) a % two_q)) % two_q;
+            } else {
+                uint64_t neg_a = ((uint64_t) -a) % two_q;
+                n = (n + two_q - neg_a) % two_q;
+            }
+            residues[i] = n;
+        }
+    }
+
+    mpz_t& PrimorialMod::init_K(mpz_t &K, const Primorial &form) {
+        mpz_init(K);
+        mpz_primorial_ui(K, form.P);
+        assert(mpz_divisible_ui_p(K, form.d));
+        mpz_divexact_ui(K, K, form.d);
+        return K;
+    }
+
+    PrimorialMod::PrimorialMod(const Primorial &form)
+        : form(form), K_mod(init_K(K, form)) {}
+
+    PrimorialMod::~PrimorialMod() {
+        mpz_clear(K);
+    }
+
+    void PrimorialMod::mod_K(const uint64_t *moduli, size_t count, uint64_t *residues) {
+        // P# has one factor of 2, K is odd iff d is even.
+        const uint64_t K_odd = (form.d & 1) == 0;
+
+        pending_moduli.clear();
+        pending_index.clear();
+        for (size_t i = 0; i < count; i++) {
+            uint64_t q = moduli[i] >> 1;
+            assert(moduli[i] == 2 * q && (q & 1));
+            if (q <= form.P && (form.d % q) != 0) {
+                // K = 0 mod q, CRT with K mod 2
+                residues[i] = K_odd ? q : 0;
+            } else {
+                pending_moduli.push_back(moduli[i]);
+                pending_index.push_back(i);
+            }
+        }
+
+        if (!pending_moduli.empty()) {
+            pending_residues.resize(pending_moduli.size());
+            K_mod.mod(pending_moduli.data(), pending_moduli.size(), pending_residues.data());
+            for (size_t j = 0; j < pending_index.size(); j++) {
+                residues[pending_index[j]] = pending_residues[j];
+            }
+        }
+    }
+
+    void PrimorialMod::mod(const uint64_t *moduli, size_t count, uint64_t *residues) {
+        mod_K(moduli, count, residues);
+        form.from_K(moduli, residues, count, residues);
+    }
+
+    std::unique_ptr<Residues> make_residues(const mpz_t &N, const Primorial *form) {
+        if (form) {
+            return std::unique_ptr<Residues>(new PrimorialMod(*form));
+        }
+        return std::unique_ptr<Residues>(new BatchMod(N));
+    }
+}
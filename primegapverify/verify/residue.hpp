@@ -0,0 +1,143 @@
+// Copyright 2020 Seth Troisi
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <gmp.h>
+
+namespace residue {
+    // Below this many bits of N, mpz_fdiv_ui per modulus is faster than a tree.
+    const size_t TREE_MIN_BITS = 40000;
+
+    /**
+     * Computes N mod m for batches of word sized moduli with a product /
+     * remainder tree, replacing one multi-limb division of N per modulus with
+     * a handful of balanced divisions shared by the whole batch.
+     */
+    class RemainderTree {
+        public:
+            RemainderTree(const mpz_t &N);
+            ~RemainderTree();
+
+            // Number of moduli per call to mod() that makes the root ~ size of N.
+            size_t batch_size() const { return batch; }
+
+            // residues[i] = N mod moduli[i], moduli[i] < 2^40, count <= batch_size()
+            void mod(const uint64_t *moduli, size_t count, uint64_t *residues);
+
+        private:
+            // moduli multiplied together in each leaf.
+            static const size_t LEAF = 8;
+
+            mpz_t N;
+            size_t batch;
+            // Number of leaves (power of 2), nodes are 1 indexed heap order.
+            size_t leaves;
+            std::unique_ptr<mpz_t[]> prod;
+            std::unique_ptr<mpz_t[]> rem;
+    };
+
+    /**
+     * residues[i] = N mod moduli[i] for count moduli with one mpz_fdiv_ui per
+     * group of consecutive moduli whose product fits in a word.
+     */
+    void mod_packed(const mpz_t &N, const uint64_t *moduli, size_t count, uint64_t *residues);
+
+    /**
+     * N mod moduli[i] for batches of moduli.
+     * Not thread safe, use one per thread.
+     */
+    class Residues {
+        public:
+            virtual ~Residues() = default;
+
+            virtual size_t batch_size() const = 0;
+
+            // residues[i] = N mod moduli[i], count <= batch_size()
+            virtual void mod(const uint64_t *moduli, size_t count, uint64_t *residues) = 0;
+    };
+
+    // Picks the faster of mod_packed and RemainderTree for the size of N.
+    class BatchMod : public Residues {
+        public:
+            BatchMod(const mpz_t &N);
+            ~BatchMod();
+
+            size_t batch_size() const { return tree ? tree->batch_size() : PACKED_BATCH; }
+
+            void mod(const uint64_t *moduli, size_t count, uint64_t *residues);
+
+        private:
+            static const size_t PACKED_BATCH = 1024;
+
+            mpz_t N;
+            std::unique_ptr<RemainderTree> tree;
+    };
+
+    // N = m * P# / d + a
+    struct Primorial {
+        uint64_t m;
+        uint64_t P;
+        uint64_t d;
+        int64_t a;
+
+        // Sets N, returns false if d doesn't divide P# or N < 0.
+        bool value(mpz_t &N) const;
+
+        // residues[i] = N mod moduli[i] from K_residues[i] = P#/d mod moduli[i].
+        // residues may be K_residues.
+        void from_K(const uint64_t *moduli, const uint64_t *K_residues, size_t count,
+                    uint64_t *residues) const;
+    };
+
+    /**
+     * N mod 2q for N = m * K + a, K = P#/d, computed from the parts.
+     *
+     * For q <= P (and q not dividing d) K is 0 mod q, so no big integer is used.
+     * For q > P only K is reduced (in batches) which can be shared by many m.
+     * Computing P# mod q from the primes <= P costs pi(P) mulmods which is
+     * slower than one pass over the limbs of K.
+     *
+     * moduli passed to mod() must be 2 * odd prime.
+     */
+    class PrimorialMod : public Residues {
+        public:
+            PrimorialMod(const Primorial &form);
+            ~PrimorialMod();
+
+            size_t batch_size() const { return K_mod.batch_size(); }
+
+            void mod(const uint64_t *moduli, size_t count, uint64_t *residues);
+
+            // Residues of K (in place of N) for moduli, used by callers varying m.
+            void mod_K(const uint64_t *moduli, size_t count, uint64_t *residues);
+
+        private:
+            static mpz_t& init_K(mpz_t &K, const Primorial &form);
+
+            const Primorial form;
+            mpz_t K;
+            BatchMod K_mod;
+            std::vector<uint64_t> pending_moduli;
+            std::vector<uint64_t> pending_residues;
+            std::vector<size_t> pending_index;
+    };
+
+    // PrimorialMod if form is given, else BatchMod over N.
+    std::unique_ptr<Residues> make_residues(const mpz_t &N, const Primorial *form);
+}
@@ -20,15 +20,27 @@
 
 #include "sieve_util.hpp"
 #include "primes.hpp"
+#include "residue.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <gmp.h>
 
 namespace sieve_util {
@@ -47,28 +59,473 @@ namespace sieve_util {
     }
 
 
-    std::vector<uint64_t> sieve_factors(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count) {
+    /**
+     * Only odd numbers are stored, entry i is N + first_odd + 2*i. Evens (and
+     * their factor 2) are filled in when expanding to the full interval.
+     *
+     * Dense primes (p < block size) hit every block many times, these are
+     * sieved block by block so writes stay in L1/L2 cache. Larger primes are
+     * sieved over the full interval afterwards, ascending, so the largest
+     * prime factor is always the last written (same as an unsegmented sieve).
+     */
+    const uint64_t SEGMENT_BYTES = 1 << 18;
+
+    // Large prime chunks handed out to each thread.
+    const uint64_t CHUNKS_PER_THREAD = 8;
+
+    /**
+     * The smallest primes do most of the writes. Their odd multiples repeat
+     * every (product of primes) entries so they are precomputed into tiles.
+     * The first tile is copied over each block, later tiles are merged with max
+     * (all their primes are larger so max is the same as writing ascending).
+     */
+    const std::vector<std::vector<uint32_t>> TILE_PRIMES = {
+        {3, 5, 7, 11, 13},  // 15015
+        {17, 19, 23},       // 7429
+        {29, 31, 37},       // 33263
+    };
+
+    template <typename T>
+    T mark_value(uint64_t prime);
+
+    template <>
+    uint64_t mark_value<uint64_t>(uint64_t prime) { return prime; }
+
+    template <>
+    char mark_value<char>(uint64_t prime) { return 1; }
+
+    template <>
+    uint32_t mark_value<uint32_t>(uint64_t prime) {
+        return prime < LARGE_FACTOR ? prime : LARGE_FACTOR;
+    }
+
+    // Offset of first odd multiple of prime in [N, N+...] given N mod 2 * prime
+    inline uint64_t first_odd_multiple(uint64_t two_p, uint64_t N_mod) {
+        // Same as mpz_cdiv_ui(N, two_p)
+        uint64_t first = N_mod == 0 ? 0 : two_p - N_mod;
+        first += two_p >> 1;
+        if (first >= two_p) first -= two_p;
+        return first;
+    }
+
+    // residues.mod in batches of residues.batch_size()
+    void mod_all(residue::Residues &residues, const std::vector<uint64_t> &moduli,
+                 std::vector<uint64_t> &result) {
+        result.resize(moduli.size());
+        for (size_t i = 0; i < moduli.size(); i += residues.batch_size()) {
+            size_t count = std::min(residues.batch_size(), moduli.size() - i);
+            residues.mod(moduli.data() + i, count, result.data() + i);
+        }
+    }
+
+    struct SmallPrimes {
+        // primes <= gap, index of first odd multiple of each
+        std::vector<uint32_t> primes;
+        std::vector<uint32_t> first;
+        // primes[0, wheel) come from TILE_PRIMES[0, tiles), primes[wheel, dense)
+        // are sieved block by block.
+        size_t tiles = 0;
+        size_t wheel = 0;
+        size_t dense = 0;
+
+        // Index of 1 (which is marked composite) or -1
+        int64_t one_index = -1;
+    };
+
+    // tile[k] = mark for entry k (mod period), 2 periods long.
+    template <typename T>
+    uint64_t fill_tile(const SmallPrimes &small, size_t pi, size_t num_primes, std::vector<T> &tile) {
+        uint64_t period = 1;
+        for (size_t i = pi; i < pi + num_primes; i++) {
+            period *= small.primes[i];
+        }
+
+        tile.assign(2 * period, 0);
+        for (size_t i = pi; i < pi + num_primes; i++) {
+            const uint64_t p = small.primes[i];
+            for (uint64_t k = small.first[i] % p; k < tile.size(); k += p) {
+                tile[k] = mark_value<T>(p);
+            }
+        }
+        return period;
+    }
+
+    /**
+     * Sieve entries [lo, hi) of the odd array with small primes.
+     * Only writes inside [lo, hi) so disjoint ranges can run concurrently.
+     */
+    template <typename T>
+    void sieve_small_range(T *composite, const SmallPrimes &small,
+                           uint64_t lo, uint64_t hi) {
+        const uint64_t segment = SEGMENT_BYTES / sizeof(T);
+
+        std::vector<std::vector<T>> tiles(small.tiles);
+        std::vector<uint64_t> periods(small.tiles);
+        for (size_t t = 0, pi = 0; t < small.tiles; t++) {
+            periods[t] = fill_tile(small, pi, TILE_PRIMES[t].size(), tiles[t]);
+            pi += TILE_PRIMES[t].size();
+        }
+
+        // Next odd multiple of each dense prime.
+        std::vector<uint32_t> next_mod(small.dense);
+        for (size_t pi = small.wheel; pi < small.dense; pi++) {
+            uint64_t p = small.primes[pi];
+            uint64_t i = small.first[pi];
+            if (i < lo) i += (lo - i + p - 1) / p * p;
+            next_mod[pi] = i;
+        }
+
+        for (uint64_t block = lo; block < hi; block += segment) {
+            const uint64_t block_end = std::min(block + segment, hi);
+
+            if (small.tiles) {
+                // Stamp the first tile
+                const uint64_t period = periods[0];
+                for (uint64_t i = block; i < block_end; i += period) {
+                    size_t count = std::min(period, block_end - i);
+                    std::copy_n(tiles[0].begin() + (i % period), count, composite + i);
+                }
+            } else {
+                std::fill(composite + block, composite + block_end, 0);
+            }
+
+            for (size_t t = 1; t < small.tiles; t++) {
+                const uint64_t period = periods[t];
+                for (uint64_t i = block; i < block_end; i += period) {
+                    size_t count = std::min(period, block_end - i);
+                    const T *tile = tiles[t].data() + (i % period);
+                    T *out = composite + i;
+                    for (size_t j = 0; j < count; j++) {
+                        out[j] = std::max(out[j], tile[j]);
+                    }
+                }
+            }
+
+            // Mark 1 as composite because.
+            if (small.one_index >= 0 &&
+                    block <= (uint64_t) small.one_index && (uint64_t) small.one_index < block_end) {
+                composite[small.one_index] = mark_value<T>(1);
+            }
+
+            for (size_t pi = small.wheel; pi < small.dense; pi++) {
+                const uint64_t p = small.primes[pi];
+                const T mark = mark_value<T>(p);
+                uint64_t i = next_mod[pi];
+                for (; i < block_end; i += p) {
+                    composite[i] = mark;
+                }
+                next_mod[pi] = i;
+            }
+        }
+
+        // medium primes, still multiple per interval but at most one per block
+        for (size_t pi = small.dense; pi < small.primes.size(); pi++) {
+            const uint64_t p = small.primes[pi];
+            const T mark = mark_value<T>(p);
+            uint64_t i = small.first[pi];
+            if (i < lo) i += (lo - i + p - 1) / p * p;
+            for (; i < hi; i += p) {
+                composite[i] = mark;
+            }
+        }
+    }
+
+    /**
+     * Primes larger than the interval of one N, each marks at most one entry.
+     * hits[c] and count[c] are (index, prime) and the number of primes from
+     * chunk c of the shared pass over primes.
+     */
+    struct LargeJob {
+        mpz_t *N;
+        const residue::Primorial *form;
+        // gap + 1
+        uint64_t gap;
+        uint64_t first_odd;
+        // Primes in [start, stop]
+        uint64_t start;
+        uint64_t stop;
+
+        std::vector<std::vector<std::pair<uint32_t, uint64_t>>> hits;
+        std::vector<size_t> counts;
+    };
+
+    // Range of primes between calls to the checkpoint callback.
+    const uint64_t CHECKPOINT_RANGE = 1 << 28;
+
+    // Primes enumerated at once before handing them to each group of jobs.
+    const size_t PRIME_BUFFER = 1 << 16;
+
+    /**
+     * Appends (index, prime) to hits in increasing prime order given
+     * residues[i] = N mod two_p[i].
+     */
+    void add_hits(const uint64_t *two_p, const uint64_t *residues, size_t count,
+                  uint64_t gap, uint64_t first_odd,
+                  std::vector<std::pair<uint32_t, uint64_t>> &hits) {
+        for (size_t i = 0; i < count; i++) {
+            uint64_t first = first_odd_multiple(two_p[i], residues[i]);
+            if (first < gap) {
+                hits.emplace_back((first - first_odd) >> 1, two_p[i] >> 1);
+            }
+        }
+    }
+
+    /**
+     * Jobs whose N = m * K + a share K = P#/d, K mod 2p is computed once for
+     * the group and each N only costs a mulmod per prime.
+     * Jobs without a form are a group of their own over N.
+     */
+    struct JobGroup {
+        std::vector<LargeJob*> jobs;
+        // Primes in [start, stop] are needed by some job.
+        uint64_t start;
+        uint64_t stop;
+    };
+
+    std::vector<JobGroup> group_jobs(const std::vector<LargeJob*> &jobs) {
+        std::vector<JobGroup> groups;
+        for (auto *job : jobs) {
+            if (job->start > job->stop) continue;
+
+            auto same_K = [job](const JobGroup &group) {
+                const auto *form = group.jobs[0]->form;
+                return job->form && form && form->P == job->form->P && form->d == job->form->d;
+            };
+            auto group = std::find_if(groups.begin(), groups.end(), same_K);
+            if (group == groups.end()) {
+                groups.push_back({{job}, job->start, job->stop});
+            } else {
+                group->jobs.push_back(job);
+                group->start = std::min(group->start, job->start);
+                group->stop = std::max(group->stop, job->stop);
+            }
+        }
+        return groups;
+    }
+
+    double seconds_since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * Progress of sieve_large printed to stderr every stats->progress_seconds.
+     * Workers report after each buffer of primes, does nothing without stats.
+     */
+    class Progress {
+        public:
+            Progress(const SieveStats *stats, uint64_t lo, uint64_t hi)
+                : enabled(stats && stats->progress_seconds > 0),
+                  interval(stats ? stats->progress_seconds : 0),
+                  lo(lo), hi(hi), start(std::chrono::steady_clock::now()), last(start) {}
+
+            // range numbers holding count primes were sieved.
+            void add(uint64_t range, uint64_t count) {
+                if (!enabled) return;
+                const uint64_t done = covered += range;
+                const uint64_t primes_done = primes += count;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                auto now = std::chrono::steady_clock::now();
+                if (std::chrono::duration<double>(now - last).count() < interval) return;
+                last = now;
+
+                const double elapsed = seconds_since(start);
+                const double fraction = (double) done / (hi - lo + 1);
+                fprintf(stderr, "sieve: primes [%.2e, %.2e] %5.1f%%, %.2e primes/s, "
+                        "elapsed %.0fs, ETA %.0fs\n",
+                        (double) lo, (double) hi, 100 * fraction, primes_done / elapsed,
+                        elapsed, elapsed * (1 - fraction) / fraction);
+            }
+
+        private:
+            const bool enabled;
+            const double interval;
+            const uint64_t lo, hi;
+            const std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point last;
+            std::atomic<uint64_t> covered{0};
+            std::atomic<uint64_t> primes{0};
+            std::mutex mutex;
+    };
+
+    /**
+     * One pass over the primes in [min start, max stop] of jobs shared by all
+     * the jobs. The range is split into chunks handed out to threads.
+     *
+     * N (or K) mod 2p is computed in batches (see residue.hpp) which is ~2x
+     * faster than mpz_cdiv_ui per prime.
+     */
+    void sieve_large(const std::vector<LargeJob*> &jobs, int threads, SieveStats *stats) {
+        const std::vector<JobGroup> groups = group_jobs(jobs);
+        if (groups.empty()) return;
+        const auto start_time = std::chrono::steady_clock::now();
+
+        uint64_t lo = UINT64_MAX, hi = 0;
+        for (const auto &group : groups) {
+            lo = std::min(lo, group.start);
+            hi = std::max(hi, group.stop);
+        }
+
+        const uint64_t num_chunks = threads == 1 ? 1 : threads * CHUNKS_PER_THREAD;
+        const uint64_t chunk_size = (hi - lo) / num_chunks + 1;
+        for (auto *job : jobs) {
+            job->hits.assign(num_chunks, {});
+            job->counts.assign(num_chunks, 0);
+        }
+        std::atomic<uint64_t> next_chunk(0);
+        Progress progress(stats, lo, hi);
+
+        auto worker = [&]() {
+            // Each worker keeps its residues and sieving primes between chunks.
+            std::vector<std::unique_ptr<residue::PrimorialMod>> K_mods(groups.size());
+            std::vector<std::unique_ptr<residue::Residues>> N_mods(groups.size());
+            primes::iterator iter;
+            std::vector<uint64_t> buffer, two_p, base, residues;
+            for (uint64_t c = next_chunk++; c < num_chunks; c = next_chunk++) {
+                uint64_t start = lo + c * chunk_size;
+                uint64_t stop = std::min(start + chunk_size - 1, hi);
+                if (start > stop) continue;
+
+                iter.jump_to(start, stop);
+                uint64_t prime = iter.next();
+                uint64_t position = start;
+                while (prime <= stop) {
+                    buffer.clear();
+                    for (; buffer.size() < PRIME_BUFFER && prime <= stop; prime = iter.next()) {
+                        buffer.push_back(prime);
+                    }
+                    const uint64_t next_position = std::min(prime, stop + 1);
+                    progress.add(next_position - position, buffer.size());
+                    position = next_position;
+
+                    for (size_t g = 0; g < groups.size(); g++) {
+                        const JobGroup &group = groups[g];
+                        auto first = std::lower_bound(buffer.begin(), buffer.end(), group.start);
+                        auto last = std::upper_bound(first, buffer.end(), group.stop);
+                        if (first == last) continue;
+
+                        const residue::Primorial *form = group.jobs[0]->form;
+                        residue::Residues *batch_mod;
+                        if (form) {
+                            if (!K_mods[g]) K_mods[g].reset(new residue::PrimorialMod(*form));
+                            batch_mod = K_mods[g].get();
+                        } else {
+                            if (!N_mods[g]) N_mods[g] = residue::make_residues(*group.jobs[0]->N, nullptr);
+                            batch_mod = N_mods[g].get();
+                        }
+
+                        const size_t count = last - first;
+                        two_p.resize(count);
+                        base.resize(count);
+                        residues.resize(count);
+                        for (size_t i = 0; i < count; i++) {
+                            two_p[i] = 2 * first[i];
+                        }
+                        for (size_t i = 0; i < count; i += batch_mod->batch_size()) {
+                            size_t size = std::min(batch_mod->batch_size(), count - i);
+                            if (form) {
+                                K_mods[g]->mod_K(two_p.data() + i, size, base.data() + i);
+                            } else {
+                                batch_mod->mod(two_p.data() + i, size, base.data() + i);
+                            }
+                        }
+
+                        for (auto *job : group.jobs) {
+                            size_t j0 = std::lower_bound(first, last, job->start) - first;
+                            size_t j1 = std::upper_bound(first, last, job->stop) - first;
+                            if (j0 == j1) continue;
+
+                            const uint64_t *N_residues = base.data() + j0;
+                            if (form) {
+                                job->form->from_K(two_p.data() + j0, base.data() + j0,
+                                                  j1 - j0, residues.data());
+                                N_residues = residues.data();
+                            }
+                            job->counts[c] += j1 - j0;
+                            add_hits(two_p.data() + j0, N_residues, j1 - j0,
+                                     job->gap, job->first_odd, job->hits[c]);
+                        }
+                    }
+                }
+            }
+        };
+        if (threads == 1) {
+            worker();
+        } else {
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) workers.emplace_back(worker);
+            for (auto &w : workers) w.join();
+        }
+        if (stats) stats->large_seconds += seconds_since(start_time);
+    }
+
+    // Merge hits in chunk order so larger primes still win.
+    template <typename T>
+    void apply_hits(const LargeJob &job, size_t &prime_count, SieveStats *stats, T *composite,
+                    std::vector<std::pair<uint32_t, uint64_t>> *large) {
+        const auto start_time = std::chrono::steady_clock::now();
+        for (size_t c = 0; c < job.hits.size(); c++) {
+            prime_count += job.counts[c];
+            if (stats) {
+                stats->large_primes += job.counts[c];
+                stats->large_marks += job.hits[c].size();
+            }
+            for (auto &hit : job.hits[c]) {
+                composite[hit.first] = mark_value<T>(hit.second);
+                if (large && hit.second >= LARGE_FACTOR) {
+                    large->push_back(hit);
+                }
+            }
+        }
+
+        if (large) {
+            // Keep only the last (largest) factor for each index.
+            std::stable_sort(large->begin(), large->end(),
+                [](const auto &a, const auto &b) { return a.first < b.first; });
+            auto last = std::unique(large->rbegin(), large->rend(),
+                [](const auto &a, const auto &b) { return a.first == b.first; });
+            large->erase(large->begin(), last.base());
+        }
+        if (stats) stats->large_seconds += seconds_since(start_time);
+    }
+
+    // Number of odd numbers in [N, N+gap]
+    inline uint64_t count_odds(uint64_t first_odd, uint64_t gap) {
+        return first_odd <= gap ? (gap - first_odd) / 2 + 1 : 0;
+    }
+
+    /**
+     * Sieves the odd numbers in [N, N+gap] with primes <= gap and fills in job
+     * for the remaining primes (start > stop if there are none).
+     * Returns false (and composite is undefined) if the sieve couldn't run.
+     */
+    template <typename T>
+    bool sieve_odds_small(mpz_t &N, const residue::Primorial *form,
+                          uint64_t gap, uint64_t limit, size_t &prime_count,
+                          int threads, SieveStats *stats, T *composite, LargeJob &job) {
+        const auto start_time = std::chrono::steady_clock::now();
+
         // 8GB would be a lot ram.
-        if ((gap < 0) || (gap > (1L << 26))) { return {}; }
-        if (limit > (1L << 50)) { return {}; }
+        if ((gap < 0) || (gap > (1L << 26))) { return false; }
+        if (limit > (1L << 50)) { return false; }
+        if (threads < 1) { return false; }
+
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        const uint64_t odds = count_odds(first_odd, gap);
 
         // Sieve of [N, N+gap]
         gap += 1;
-        std::vector<uint64_t> composite(gap, 0);
+
+        SmallPrimes small;
 
         // primes >= N_int, should avoid marking themselves off.
         uint64_t N_int = mpz_cmp_ui(N, limit) <= 0 ? mpz_get_ui(N) : limit + 1;
         // only needed when limit > N
         uint64_t N_end = N_int + gap;
 
-        // Mark 0 as composite because.
-        if ((N_int == 0) && (N_end >= 0)) {
-            composite[0] = 1;
-        }
-
         // Mark 1 as composite because.
         if ((N_int <= 1) && (N_end >= 1)) {
-            composite[1 - N_int] = 1;
+            small.one_index = (1 - N_int - first_odd) >> 1;
         }
 
         // limit doesn't need to exceed sqrt(N + gap)
@@ -79,7 +536,7 @@ namespace sieve_util {
             mpz_add_ui(temp, N, gap);
             mpz_sqrt(temp, temp);
             if (mpz_cmp_ui(temp, limit) < 0) {
-                if (!mpz_fits_ulong_p(temp)) { return {}; }
+                if (!mpz_fits_ulong_p(temp)) { return false; }
                 limit = mpz_get_ui(temp);
             }
 
@@ -87,16 +544,7 @@ namespace sieve_util {
         }
 
         // Something didn't go right with sqrt
-        if (limit > N_end) { return {}; }
-
-        // Remove all evens
-        for (uint32_t d = mpz_cdiv_ui(N, 2); d < gap; d += 2) {
-            composite[d] = 2;
-        }
-        if ((N_int <= 2) && (N_end >= 2)) {
-            // Go back and mark 2 as prime
-            composite[2 - N_int] = 0;
-        }
+        if (limit > N_end) { return false; }
 
         prime_count = 1;
         primes::iterator iter;
@@ -106,70 +554,816 @@ namespace sieve_util {
         assert(prime == 3);
 
         // small primes can divide multiple numbers
+        const uint64_t segment = SEGMENT_BYTES / sizeof(T);
+        std::vector<uint64_t> two_p;
         for (; prime <= gap && prime <= limit; prime = iter.next()) {
             prime_count++;
+            if (prime < segment) {
+                small.dense++;
+            }
+            small.primes.push_back(prime);
+            two_p.push_back(2 * prime);
+        }
+
+        {
+            std::vector<uint64_t> residues;
+            auto batch_mod = residue::make_residues(N, form);
+            mod_all(*batch_mod, two_p, residues);
+
+            small.first.resize(two_p.size());
+            for (size_t pi = 0; pi < two_p.size(); pi++) {
+                uint64_t first = first_odd_multiple(two_p[pi], residues[pi]);
+                // Don't mark prime as dividing prime.
+                if (N_int <= small.primes[pi]) {
+                    first += two_p[pi];
+                }
+                small.first[pi] = (first - first_odd) >> 1;
+            }
+        }
 
-            uint64_t two_p = 2 * prime;
-            uint64_t first = mpz_cdiv_ui(N, two_p);
-            first += prime;
-            if (first >= two_p) first -= two_p;
+        // Use tiles when they can't mark the primes themselves and are
+        // shorter than the interval (else building them costs more).
+        int tile_groups = stats ? stats->tile_groups : TILE_GROUPS;
+        for (int t = 0; t < std::min<int>(tile_groups, TILE_PRIMES.size()); t++) {
+            size_t end = small.wheel + TILE_PRIMES[t].size();
+            if (end > small.dense || N_int <= small.primes[end - 1]) break;
+            // Each tile repeats with its own period.
+            uint64_t period = 1;
+            for (auto p : TILE_PRIMES[t]) period *= p;
+            if (period > odds) break;
+            assert(small.primes[end - 1] == TILE_PRIMES[t].back());
+            small.tiles++;
+            small.wheel = end;
+        }
 
-            // Don't mark prime as dividing prime.
-            if (N_int <= prime) {
-                first += two_p;
+        if (threads == 1) {
+            sieve_small_range(composite, small, 0, odds);
+        } else {
+            // Each thread gets a contiguous, block aligned, part of the interval.
+            uint64_t per_thread = (odds / threads + segment) / segment * segment;
+            std::vector<std::thread> workers;
+            for (uint64_t lo = 0; lo < odds; lo += per_thread) {
+                uint64_t hi = std::min(lo + per_thread, odds);
+                workers.emplace_back(sieve_small_range<T>, composite, std::cref(small), lo, hi);
             }
-            for (uint32_t d = first; d < gap; d += two_p) {
-                composite[d] = prime;
+            for (auto &worker : workers) worker.join();
+        }
+
+        if (stats) {
+            stats->small_seconds += seconds_since(start_time);
+            stats->small_primes += prime_count;
+            stats->small_tiles = std::max<uint64_t>(stats->small_tiles, small.tiles);
+            for (size_t pi = 0; pi < small.primes.size(); pi++) {
+                if (small.first[pi] < odds)
+                    stats->small_marks += (odds - 1 - small.first[pi]) / small.primes[pi] + 1;
             }
         }
 
+        job = {&N, form, gap, first_odd, prime, limit, {}, {}};
+
         // Only one in the interval (prime > gap)
-        if (prime >= N_int) {
+        if (prime >= N_int || prime > limit) {
             // Avoid marking self off by starting at 3*prime => out of interval
-            return composite;
+            job.start = 1;
+            job.stop = 0;
+            return true;
         }
 
         assert(N_int > prime);
         assert(N_int > limit);
 
-        for (; prime <= limit; prime = iter.next()) {
-            prime_count++;
+        // Only one in the interval
+        // either N_int <= prime (the number is the prime)
+        // or N_int > prime (and we mark off some multiple)
+        return true;
+    }
 
-            // Only one in the interval
-            // either N_int <= prime (the number is the prime)
-            // or N_int > prime (and we mark off some multiple)
+    /**
+     * Writes count_odds(first_odd, gap) entries for the odd numbers in [N, N+gap].
+     * Returns false (and composite is undefined) if the sieve couldn't run.
+     *
+     * If large is given (index, prime) for primes >= LARGE_FACTOR that are the
+     * largest factor found are appended to it, sorted by index.
+     */
+    template <typename T>
+    bool sieve_odds(mpz_t &N, const residue::Primorial *form,
+                    uint64_t gap, uint64_t limit, size_t &prime_count,
+                    int threads, SieveStats *stats, T *composite,
+                    std::vector<std::pair<uint32_t, uint64_t>> *large = nullptr) {
+        LargeJob job;
+        if (!sieve_odds_small(N, form, gap, limit, prime_count, threads, stats, composite, job)) {
+            return false;
+        }
+        sieve_large({&job}, threads, stats);
+        apply_hits(job, prime_count, stats, composite, large);
+        return true;
+    }
 
-            // Only look at odd multiples of prime
-            uint64_t two_p = 2 * prime;
-            uint64_t first = mpz_cdiv_ui(N, two_p);
-            first += prime;
-            if (first >= two_p) first -= two_p;
-            if (first < gap) {
-                composite[first] = prime;
+    /**
+     * composite[0, odds) holds the odd numbers, spread them in place to
+     * [N, N+gap] and fill in the evens.
+     */
+    template <typename T>
+    void expand_odds(mpz_t &N, uint64_t gap, SieveStats *stats, T *composite) {
+        const auto start_time = std::chrono::steady_clock::now();
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        const uint64_t odds = count_odds(first_odd, gap);
+
+        // Backwards so each entry is read before it's overwritten.
+        for (uint64_t i = odds; i-- > 0; ) {
+            composite[first_odd + 2 * i] = composite[i];
+        }
+        for (uint64_t d = 1 - first_odd; d <= gap; d += 2) {
+            composite[d] = mark_value<T>(2);
+        }
+
+        // Go back and mark 2 as prime
+        if (mpz_cmp_ui(N, 2) <= 0 && mpz_get_ui(N) + gap >= 2) {
+            composite[2 - mpz_get_ui(N)] = 0;
+        }
+
+        if (stats) {
+            stats->expand_seconds += seconds_since(start_time);
+            // The evens are 2's marks
+            stats->small_marks += gap + 1 - odds;
+        }
+    }
+
+    template <typename T>
+    bool sieve_full(mpz_t &N, const residue::Primorial *form, uint64_t gap, uint64_t limit,
+                    size_t &prime_count, int threads, SieveStats *stats, T *composite) {
+        if (!sieve_odds<T>(N, form, gap, limit, prime_count, threads, stats, composite)) {
+            return false;
+        }
+        expand_odds<T>(N, gap, stats, composite);
+        return true;
+    }
+
+    // Either N or form must be non null.
+    template <typename T>
+    std::vector<T> sieve_vector(mpz_t *N, const residue::Primorial *form, uint64_t gap, uint64_t limit,
+                                size_t &prime_count, int threads, SieveStats *stats,
+                                bool odds_only) {
+        if (gap > (1L << 26)) { return {}; }
+
+        mpz_t form_N;
+        mpz_init(form_N);
+        if (N == nullptr) {
+            if (!form->value(form_N)) {
+                mpz_clear(form_N);
+                return {};
             }
+            N = &form_N;
         }
 
-        // Possible a vector copy, but fast in the overall scheme of things.
+        const uint64_t first_odd = mpz_even_p(*N) ? 1 : 0;
+        std::vector<T> composite(odds_only ? count_odds(first_odd, gap) : gap + 1);
+        bool success = odds_only ?
+            sieve_odds<T>(*N, form, gap, limit, prime_count, threads, stats, composite.data()) :
+            sieve_full<T>(*N, form, gap, limit, prime_count, threads, stats, composite.data());
+        mpz_clear(form_N);
+        if (!success) {
+            return {};
+        }
         return composite;
     }
 
-    std::vector<char> sieve(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count) {
-        auto factors = sieve_factors(N, gap, limit, prime_count);
-        if (factors.empty()) {
-            return {};
+    std::vector<uint64_t> sieve_factors(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                                        int threads, SieveStats *stats) {
+        return sieve_vector<uint64_t>(&N, nullptr, gap, limit, prime_count, threads, stats, false);
+    }
+
+    std::vector<char> sieve(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                            int threads, SieveStats *stats) {
+        return sieve_vector<char>(&N, nullptr, gap, limit, prime_count, threads, stats, false);
+    }
+
+    std::vector<uint64_t> sieve_factors(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                                        size_t &prime_count, int threads, SieveStats *stats) {
+        return sieve_vector<uint64_t>(nullptr, &form, gap, limit, prime_count, threads, stats, false);
+    }
+
+    std::vector<char> sieve(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                            size_t &prime_count, int threads, SieveStats *stats) {
+        return sieve_vector<char>(nullptr, &form, gap, limit, prime_count, threads, stats, false);
+    }
+
+    std::vector<char> sieve_odds(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                                 int threads, SieveStats *stats) {
+        return sieve_vector<char>(&N, nullptr, gap, limit, prime_count, threads, stats, true);
+    }
+
+    std::vector<char> sieve_odds(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                                 size_t &prime_count, int threads, SieveStats *stats) {
+        return sieve_vector<char>(nullptr, &form, gap, limit, prime_count, threads, stats, true);
+    }
+
+    bool sieve_odds_checkpoint(mpz_t &N, const residue::Primorial *form,
+                               uint64_t gap, uint64_t limit, size_t &prime_count,
+                               char *composite, uint64_t resume_after,
+                               const std::function<void(uint64_t)> &checkpoint, int threads,
+                               SieveStats *stats) {
+        const uint64_t odds = odd_count(N, gap);
+        const size_t saved_count = prime_count;
+        std::vector<char> saved;
+        if (resume_after > 0) {
+            saved.assign(composite, composite + odds);
         }
 
-        // Sieve of [N, N+gap]
-        gap += 1;
-        assert(gap == factors.size());
+        // Small primes are cheap to redo, the checkpoint already includes them.
+        LargeJob job;
+        if (!sieve_odds_small(N, form, gap, limit, prime_count, threads, stats, composite, job)) {
+            return false;
+        }
+        if (resume_after > 0) {
+            prime_count = saved_count;
+        }
+        for (uint64_t i = 0; i < saved.size(); i++) {
+            composite[i] |= saved[i];
+        }
 
-        // Possible a vector copy, but fast in the overall scheme of things.
-        std::vector<char> composite(gap, 0);
-        size_t i = 0;
-        for (uint64_t f : factors) {
-            composite[i++] = f > 0;
+        // Large primes in ranges, each is fully applied before the next.
+        const uint64_t stop = job.stop;
+        uint64_t start = std::max(job.start, resume_after + 1);
+        while (start <= stop) {
+            job.start = start;
+            job.stop = std::min(stop, start + CHECKPOINT_RANGE - 1);
+            sieve_large({&job}, threads, stats);
+            apply_hits<char>(job, prime_count, stats, composite, nullptr);
+            checkpoint(job.stop);
+            start = job.stop + 1;
         }
-        return composite;
+        checkpoint(limit);
+        return true;
+    }
+
+    bool sieve_odds(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                    char *composite, uint64_t resume_after,
+                    const std::function<void(uint64_t)> &checkpoint, int threads,
+                    SieveStats *stats) {
+        return sieve_odds_checkpoint(N, nullptr, gap, limit, prime_count, composite,
+                                     resume_after, checkpoint, threads, stats);
+    }
+
+    bool sieve_odds(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                    size_t &prime_count, char *composite, uint64_t resume_after,
+                    const std::function<void(uint64_t)> &checkpoint, int threads,
+                    SieveStats *stats) {
+        mpz_t N;
+        mpz_init(N);
+        bool success = form.value(N) &&
+            sieve_odds_checkpoint(N, &form, gap, limit, prime_count, composite,
+                                  resume_after, checkpoint, threads, stats);
+        mpz_clear(N);
+        return success;
+    }
+
+    std::vector<std::vector<char>> sieve_odds_batch(
+            const std::vector<residue::Primorial> &forms,
+            const std::vector<uint64_t> &gaps, const std::vector<uint64_t> &limits,
+            std::vector<size_t> &prime_counts, int threads, SieveStats *stats) {
+        const size_t count = forms.size();
+        assert(gaps.size() == count && limits.size() == count);
+
+        std::vector<std::vector<char>> composites(count);
+        prime_counts.assign(count, 0);
+
+        std::unique_ptr<mpz_t[]> N(new mpz_t[count]);
+        std::vector<LargeJob> jobs(count);
+        std::vector<LargeJob*> active;
+        for (size_t k = 0; k < count; k++) {
+            mpz_init(N[k]);
+            if (gaps[k] > (1L << 26) || !forms[k].value(N[k])) {
+                continue;
+            }
+
+            const uint64_t first_odd = mpz_even_p(N[k]) ? 1 : 0;
+            composites[k].resize(count_odds(first_odd, gaps[k]));
+            if (!sieve_odds_small(N[k], &forms[k], gaps[k], limits[k], prime_counts[k],
+                                  threads, stats, composites[k].data(), jobs[k])) {
+                composites[k].clear();
+                continue;
+            }
+            active.push_back(&jobs[k]);
+        }
+
+        // Every N shares the enumeration of primes > gap.
+        sieve_large(active, threads, stats);
+        for (size_t k = 0; k < count; k++) {
+            if (!composites[k].empty()) {
+                apply_hits<char>(jobs[k], prime_counts[k], stats, composites[k].data(), nullptr);
+            }
+            mpz_clear(N[k]);
+        }
+        return composites;
+    }
+
+    /**
+     * Smallest i >= 0 with l <= (a * i) mod p <= r, UINT64_MAX if there is none.
+     * Needs 0 < a < p and 0 < l <= r < p. Euclid like recursion so O(log p).
+     */
+    uint64_t modulo_search(uint64_t p, uint64_t a, uint64_t l, uint64_t r) {
+        // Reflect so that 2a <= p
+        if (2 * a > p) {
+            return modulo_search(p, p - a, p - r, p - l);
+        }
+
+        // A multiple of a (before wrapping around p)
+        uint64_t i = (l + a - 1) / a;
+        if (a * i <= r) return i;
+
+        // Otherwise a * i is in [k * p + l, k * p + r] for the smallest k >= 1,
+        // which has a multiple of a iff (k * -p) mod a is in [l mod a, r mod a].
+        uint64_t p_mod = p % a;
+        if (p_mod == 0) return UINT64_MAX;
+        uint64_t k = modulo_search(a, a - p_mod, l % a, r % a);
+        if (k == UINT64_MAX) return UINT64_MAX;
+        return ((unsigned __int128) k * p + l + a - 1) / a;
+    }
+
+    /**
+     * Primes in [start, stop] for N_i = (form.m + i) * K + form.a, i in [0, count).
+     * p divides an odd number in [N_i, N_i + gap] (gap < p) iff
+     * s_i = (N_i + p + gap) mod 2p <= gap, then it's N_i + gap - s_i.
+     * s_i = s_0 + i * (K mod 2p) so the next i is a modular search.
+     * hits[c] are (i, odd index) from chunk c of the primes.
+     */
+    void sieve_large_m_range(const residue::Primorial &form, uint64_t count, uint64_t gap,
+                             uint64_t start, uint64_t stop, int threads, SieveStats *stats,
+                             std::vector<std::vector<std::pair<uint32_t, uint32_t>>> &hits,
+                             size_t &prime_count) {
+        const auto start_time = std::chrono::steady_clock::now();
+        const uint64_t num_chunks = threads == 1 ? 1 : threads * CHUNKS_PER_THREAD;
+        const uint64_t chunk_size = (stop - start) / num_chunks + 1;
+        hits.assign(num_chunks, {});
+        std::vector<size_t> counts(num_chunks, 0);
+        std::atomic<uint64_t> next_chunk(0);
+        Progress progress(stats, start, stop);
+
+        auto worker = [&]() {
+            residue::PrimorialMod K_mod(form);
+            primes::iterator iter;
+            std::vector<uint64_t> two_p, K_residues, N_residues;
+            for (uint64_t c = next_chunk++; c < num_chunks; c = next_chunk++) {
+                uint64_t lo = start + c * chunk_size;
+                uint64_t hi = std::min(lo + chunk_size - 1, stop);
+                if (lo > hi) continue;
+
+                iter.jump_to(lo, hi);
+                uint64_t prime = iter.next();
+                uint64_t position = lo;
+                while (prime <= hi) {
+                    two_p.clear();
+                    for (; two_p.size() < PRIME_BUFFER && prime <= hi; prime = iter.next()) {
+                        two_p.push_back(2 * prime);
+                    }
+                    const uint64_t next_position = std::min(prime, hi + 1);
+                    progress.add(next_position - position, two_p.size());
+                    position = next_position;
+
+                    const size_t size = two_p.size();
+                    counts[c] += size;
+                    K_residues.resize(size);
+                    N_residues.resize(size);
+                    for (size_t j = 0; j < size; j += K_mod.batch_size()) {
+                        size_t batch = std::min(K_mod.batch_size(), size - j);
+                        K_mod.mod_K(two_p.data() + j, batch, K_residues.data() + j);
+                    }
+                    form.from_K(two_p.data(), K_residues.data(), size, N_residues.data());
+
+                    for (size_t j = 0; j < size; j++) {
+                        const uint64_t q = two_p[j];
+                        const uint64_t K_q = K_residues[j];
+                        const uint64_t s_0 = (N_residues[j] + q / 2 + gap) % q;
+                        uint64_t i = 0;
+                        while (i < count) {
+                            uint64_t s = (s_0 + (unsigned __int128) K_q * i) % q;
+                            if (s <= gap) {
+                                hits[c].emplace_back(i, (gap - s) >> 1);
+                                i++;
+                                continue;
+                            }
+                            if (K_q == 0) break;
+                            uint64_t skip = modulo_search(q, K_q, q - s, q - s + gap);
+                            if (skip == UINT64_MAX) break;
+                            i += skip;
+                        }
+                    }
+                }
+            }
+        };
+        if (threads == 1) {
+            worker();
+        } else {
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++) workers.emplace_back(worker);
+            for (auto &w : workers) w.join();
+        }
+
+        for (size_t c = 0; c < num_chunks; c++) {
+            prime_count += counts[c];
+            if (stats) {
+                stats->large_primes += counts[c];
+                stats->large_marks += hits[c].size();
+            }
+        }
+        if (stats) stats->large_seconds += seconds_since(start_time);
+    }
+
+    bool sieve_odds_m_range(
+            const residue::Primorial &form, uint64_t count, uint64_t gap, uint64_t limit,
+            size_t &prime_count,
+            const std::function<bool(uint64_t, const mpz_t&, const char*)> &on_row,
+            int threads, SieveStats *stats) {
+        if (count == 0) return true;
+        if (gap > (1L << 26) || form.m + count < form.m) return false;
+
+        mpz_t N;
+        mpz_init(N);
+        if (!form.value(N)) {
+            mpz_clear(N);
+            return false;
+        }
+
+        // Small N may be the primes themselves, sieve them one at a time.
+        if (mpz_cmp_ui(N, limit) <= 0) {
+            bool success = true;
+            for (uint64_t i = 0; success && i < count; i++) {
+                residue::Primorial form_i = form;
+                form_i.m += i;
+                success = form_i.value(N);
+                auto composite = sieve_vector<char>(&N, &form_i, gap, limit, prime_count,
+                                                    threads, stats, true);
+                success &= !composite.empty();
+                success = success && on_row(i, N, composite.data());
+            }
+            mpz_clear(N);
+            return success;
+        }
+
+        // All N_i > limit from here, each has the same large primes.
+        const uint64_t stride = gap / 2 + 1;
+        const uint64_t tile = std::min(count, std::max<uint64_t>(1, M_RANGE_TILE_BYTES / stride));
+        std::vector<char> composites(tile * stride);
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> hits;
+
+        bool success = true;
+        for (uint64_t t = 0; success && t < count; t += tile) {
+            const uint64_t rows = std::min(tile, count - t);
+            residue::Primorial tile_form = form;
+            tile_form.m += t;
+
+            LargeJob job;
+            size_t small_count = 0;
+            for (uint64_t i = 0; success && i < rows; i++) {
+                residue::Primorial form_i = tile_form;
+                form_i.m += i;
+                form_i.value(N);
+                success = sieve_odds_small(N, &form_i, gap, limit, small_count, threads, stats,
+                                           composites.data() + i * stride, job);
+            }
+            if (!success) break;
+
+            prime_count = small_count;
+            if (job.start <= job.stop) {
+                sieve_large_m_range(tile_form, rows, gap, job.start, job.stop, threads, stats,
+                                    hits, prime_count);
+                for (const auto &chunk : hits) {
+                    for (const auto &hit : chunk) {
+                        composites[hit.first * stride + hit.second] = 1;
+                    }
+                }
+            }
+
+            for (uint64_t i = 0; success && i < rows; i++) {
+                residue::Primorial form_i = tile_form;
+                form_i.m += i;
+                form_i.value(N);
+                success = on_row(t + i, N, composites.data() + i * stride);
+            }
+        }
+        mpz_clear(N);
+        return success;
+    }
+
+    // Primes per batch of sieve_windowed's large primes (bucket memory ~16 bytes each).
+    const size_t WINDOWED_BATCH = 1 << 20;
+
+    // One window of the bitmap file, unmapped when it goes out of scope.
+    class MappedWindow {
+        public:
+            MappedWindow(int fd, uint64_t offset, uint64_t bytes, bool write) : bytes(bytes) {
+                void *mapped = mmap(nullptr, bytes, write ? PROT_READ | PROT_WRITE : PROT_READ,
+                                    MAP_SHARED, fd, offset);
+                data = mapped == MAP_FAILED ? nullptr : (uint8_t*) mapped;
+            }
+            ~MappedWindow() {
+                if (data) munmap(data, bytes);
+            }
+
+            void mark(uint64_t i) { data[i >> 3] |= 1 << (i & 7); }
+
+            uint8_t *data;
+
+        private:
+            const uint64_t bytes;
+    };
+
+    bool sieve_windowed(mpz_t &N, const residue::Primorial *form, uint64_t gap, uint64_t limit,
+                        const std::string &path, size_t &prime_count,
+                        const std::function<bool(uint64_t)> &on_survivor,
+                        int threads, SieveStats *stats) {
+        if (gap > MAX_WINDOWED_GAP || limit > (1L << 50) || threads < 1) return false;
+        // Every prime is below N so none can mark itself.
+        if (mpz_cmp_ui(N, limit) <= 0) return false;
+
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        const uint64_t odds = count_odds(first_odd, gap);
+        const uint64_t window_odds = 8 * WINDOW_BYTES;
+        const uint64_t windows = (odds + window_odds - 1) / window_odds;
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, (odds + 7) / 8) != 0) {
+            close(fd);
+            return false;
+        }
+
+        // Runs worker(t) on threads and reports if any failed.
+        auto run = [threads](const std::function<bool(int)> &worker) {
+            std::atomic<bool> success{true};
+            std::vector<std::thread> workers;
+            for (int t = 1; t < threads; t++) {
+                workers.emplace_back([&, t]() { if (!worker(t)) success = false; });
+            }
+            if (!worker(0)) success = false;
+            for (auto &w : workers) w.join();
+            return success.load();
+        };
+
+        std::vector<std::unique_ptr<residue::Residues>> residues;
+        for (int t = 0; t < threads; t++) {
+            residues.push_back(residue::make_residues(N, form));
+        }
+
+        // Primes smaller than a window, index of their first odd multiple.
+        auto start_time = std::chrono::steady_clock::now();
+        prime_count = 1;
+        primes::iterator iter;
+        uint64_t prime = iter.next();
+        assert(prime == 2);
+        std::vector<uint64_t> two_p;
+        for (prime = iter.next(); prime <= limit && prime < window_odds; prime = iter.next()) {
+            two_p.push_back(2 * prime);
+        }
+        prime_count += two_p.size();
+
+        std::vector<uint64_t> first;
+        mod_all(*residues[0], two_p, first);
+        for (size_t pi = 0; pi < two_p.size(); pi++) {
+            first[pi] = (first_odd_multiple(two_p[pi], first[pi]) - first_odd) >> 1;
+        }
+
+        std::atomic<uint64_t> next_window{0};
+        bool success = run([&](int) {
+            for (uint64_t w; (w = next_window++) < windows; ) {
+                const uint64_t lo = w * window_odds;
+                const uint64_t hi = std::min(odds, lo + window_odds);
+                MappedWindow window(fd, w * WINDOW_BYTES, (hi - lo + 7) / 8, true);
+                if (!window.data) return false;
+                for (size_t pi = 0; pi < two_p.size(); pi++) {
+                    const uint64_t p = two_p[pi] >> 1;
+                    uint64_t i = first[pi];
+                    if (i < lo) i += (lo - i + p - 1) / p * p;
+                    for (; i < hi; i += p) window.mark(i - lo);
+                }
+            }
+            return true;
+        });
+
+        if (stats) {
+            stats->small_seconds += seconds_since(start_time);
+            stats->small_primes += prime_count;
+            for (size_t pi = 0; pi < two_p.size(); pi++) {
+                if (first[pi] < odds)
+                    stats->small_marks += (odds - 1 - first[pi]) / (two_p[pi] >> 1) + 1;
+            }
+        }
+        std::vector<uint64_t>().swap(two_p);
+        std::vector<uint64_t>().swap(first);
+
+        // Larger primes in batches, each waits in the bucket of its next window.
+        start_time = std::chrono::steady_clock::now();
+        Progress progress(stats, prime, limit);
+        std::vector<uint64_t> batch;
+        std::vector<uint64_t> batch_residues(WINDOWED_BATCH);
+        std::vector<std::vector<std::pair<uint64_t, uint64_t>>> buckets(windows);
+        size_t large_count = 0;
+        while (success && prime <= limit) {
+            const uint64_t batch_start = prime;
+            batch.clear();
+            for (; prime <= limit && batch.size() < WINDOWED_BATCH; prime = iter.next()) {
+                batch.push_back(2 * prime);
+            }
+            large_count += batch.size();
+
+            run([&](int t) {
+                const size_t size = residues[t]->batch_size();
+                for (size_t i = batch.size() * t / threads; i < batch.size() * (t + 1) / threads;
+                        i += size) {
+                    size_t count = std::min(size, batch.size() * (t + 1) / threads - i);
+                    residues[t]->mod(batch.data() + i, count, batch_residues.data() + i);
+                }
+                return true;
+            });
+
+            for (size_t pi = 0; pi < batch.size(); pi++) {
+                uint64_t i = (first_odd_multiple(batch[pi], batch_residues[pi]) - first_odd) >> 1;
+                if (i < odds) buckets[i / window_odds].emplace_back(i, batch[pi] >> 1);
+            }
+
+            for (uint64_t w = 0; success && w < windows; w++) {
+                if (buckets[w].empty()) continue;
+                const uint64_t lo = w * window_odds;
+                const uint64_t hi = std::min(odds, lo + window_odds);
+                MappedWindow window(fd, w * WINDOW_BYTES, (hi - lo + 7) / 8, true);
+                success = window.data != nullptr;
+                for (size_t b = 0; success && b < buckets[w].size(); b++) {
+                    uint64_t i = buckets[w][b].first;
+                    const uint64_t p = buckets[w][b].second;
+                    window.mark(i - lo);
+                    // p > window_odds so the next multiple is in a later window.
+                    if ((i += p) < odds) buckets[i / window_odds].emplace_back(i, p);
+                }
+                if (stats) stats->large_marks += buckets[w].size();
+                std::vector<std::pair<uint64_t, uint64_t>>().swap(buckets[w]);
+            }
+            progress.add(prime - batch_start, batch.size());
+        }
+        prime_count += large_count;
+
+        if (stats) {
+            stats->large_seconds += seconds_since(start_time);
+            stats->large_primes += large_count;
+        }
+
+        for (uint64_t w = 0; success && w < windows; w++) {
+            const uint64_t lo = w * window_odds;
+            const uint64_t hi = std::min(odds, lo + window_odds);
+            MappedWindow window(fd, w * WINDOW_BYTES, (hi - lo + 7) / 8, false);
+            success = window.data != nullptr;
+            for (uint64_t i = lo; success && i < hi; i++) {
+                if (!((window.data[(i - lo) >> 3] >> ((i - lo) & 7)) & 1)) {
+                    success = on_survivor(first_odd + 2 * i);
+                }
+            }
+        }
+
+        success &= close(fd) == 0;
+        return success;
+    }
+
+    bool sieve_odds_windowed(mpz_t &N, uint64_t gap, uint64_t limit, const std::string &path,
+                             size_t &prime_count,
+                             const std::function<bool(uint64_t)> &on_survivor,
+                             int threads, SieveStats *stats) {
+        return sieve_windowed(N, nullptr, gap, limit, path, prime_count, on_survivor,
+                              threads, stats);
+    }
+
+    bool sieve_odds_windowed(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                             const std::string &path, size_t &prime_count,
+                             const std::function<bool(uint64_t)> &on_survivor,
+                             int threads, SieveStats *stats) {
+        mpz_t N;
+        mpz_init(N);
+        bool success = form.value(N) &&
+            sieve_windowed(N, &form, gap, limit, path, prime_count, on_survivor, threads, stats);
+        mpz_clear(N);
+        return success;
+    }
+
+    Session::Session(const mpz_t &N_in, const residue::Primorial *form_in, uint64_t gap)
+            : has_form(form_in != nullptr), gap_(gap) {
+        mpz_init_set(N, N_in);
+        if (form_in) form = *form_in;
+        composite_.resize(count_odds(mpz_even_p(N) ? 1 : 0, gap));
+    }
+
+    Session::~Session() {
+        mpz_clear(N);
+    }
+
+    uint64_t Session::survivors() const {
+        return std::count(composite_.begin(), composite_.end(), 0);
+    }
+
+    void Session::expand(char *full) const {
+        std::copy(composite_.begin(), composite_.end(), full);
+        mpz_t temp;
+        mpz_init_set(temp, N);
+        expand_odds<char>(temp, gap_, nullptr, full);
+        mpz_clear(temp);
+    }
+
+    bool Session::resieve(int threads, SieveStats *stats) {
+        size_t prime_count;
+        auto composite = sieve_vector<char>(&N, has_form ? &form : nullptr, gap_, limit_,
+                                            prime_count, threads, stats, true);
+        if (composite.empty()) return false;
+        composite_.swap(composite);
+        prime_count_ = prime_count;
+        return true;
+    }
+
+    bool Session::extend_limit(uint64_t new_limit, int threads, SieveStats *stats) {
+        if (new_limit <= limit_) return true;
+        const uint64_t old_limit = limit_;
+        limit_ = new_limit;
+
+        if (old_limit <= gap_ || mpz_cmp_ui(N, new_limit) <= 0) {
+            if (resieve(threads, stats)) return true;
+            limit_ = old_limit;
+            return false;
+        }
+
+        // Every prime in (old_limit, new_limit] is > gap and < N, at most one mark each.
+        const uint64_t first_odd = mpz_even_p(N) ? 1 : 0;
+        LargeJob job = {&N, has_form ? &form : nullptr, gap_ + 1, first_odd,
+                        old_limit + 1, new_limit, {}, {}};
+        sieve_large({&job}, threads, stats);
+        apply_hits<char>(job, prime_count_, stats, composite_.data(), nullptr);
+        return true;
+    }
+
+    bool Session::extend_interval(uint64_t new_gap, int threads, SieveStats *stats) {
+        if (new_gap <= gap_) return true;
+        if (new_gap > (1L << 26)) return false;
+        const uint64_t old_gap = gap_;
+        gap_ = new_gap;
+
+        if (limit_ == 0) {
+            composite_.resize(count_odds(mpz_even_p(N) ? 1 : 0, gap_));
+            return true;
+        }
+        if (mpz_cmp_ui(N, limit_) <= 0) {
+            if (resieve(threads, stats)) return true;
+            gap_ = old_gap;
+            return false;
+        }
+
+        // Sieve (old_gap, new_gap] on its own, its odd numbers follow the old ones.
+        const uint64_t odds = count_odds(mpz_even_p(N) ? 1 : 0, gap_);
+        if (odds == composite_.size()) return true;
+        mpz_t N_new;
+        mpz_init(N_new);
+        mpz_add_ui(N_new, N, old_gap + 1);
+        residue::Primorial form_new = form;
+        form_new.a += old_gap + 1;
+
+        size_t prime_count;
+        auto added = sieve_vector<char>(&N_new, has_form ? &form_new : nullptr,
+                                        new_gap - old_gap - 1, limit_, prime_count,
+                                        threads, stats, true);
+        mpz_clear(N_new);
+        if (added.empty()) {
+            gap_ = old_gap;
+            return false;
+        }
+        composite_.insert(composite_.end(), added.begin(), added.end());
+        assert(composite_.size() == odds);
+        return true;
+    }
+
+    uint64_t odd_count(mpz_t &N, uint64_t gap) {
+        return count_odds(mpz_even_p(N) ? 1 : 0, gap);
+    }
+
+    void expand_odds(mpz_t &N, uint64_t gap, char *composite) {
+        expand_odds<char>(N, gap, nullptr, composite);
+    }
+
+    bool sieve_factors_compact(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                               uint32_t *factors, std::vector<std::pair<uint32_t, uint64_t>> &large,
+                               int threads, SieveStats *stats) {
+        large.clear();
+        return sieve_odds<uint32_t>(N, nullptr, gap, limit, prime_count, threads, stats,
+                                    factors, &large);
+    }
+
+    bool sieve(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+               char *composite, int threads, SieveStats *stats) {
+        return sieve_full<char>(N, nullptr, gap, limit, prime_count, threads, stats, composite);
+    }
+
+    bool sieve(const residue::Primorial &form, uint64_t gap, uint64_t limit, size_t &prime_count,
+               char *composite, int threads, SieveStats *stats) {
+        mpz_t N;
+        mpz_init(N);
+        bool success = form.value(N) &&
+            sieve_full<char>(N, &form, gap, limit, prime_count, threads, stats, composite);
+        mpz_clear(N);
+        return success;
     }
 
 }  // namespace sieve_util
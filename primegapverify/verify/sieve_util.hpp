@@ -16,13 +16,203 @@
 
 #include <vector>
 #include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
 
 #include <gmp.h>
 
+#include "residue.hpp"
+
 namespace sieve_util {
     const uint64_t MAX_LIMIT = 10'000'000'000;
 
+    // Compact factors >= this are stored as this and listed separately.
+    const uint32_t LARGE_FACTOR = UINT32_MAX;
+
+    // Number of small prime tiles (3*5*7*11*13, 17*19*23, 29*31*37) to stamp
+    // instead of sieving those primes one by one.
+    const int TILE_GROUPS = 2;
+
     uint64_t calculate_sievelimit(double n_bits, double gap);
-    std::vector<uint64_t> sieve_factors(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count);
-    std::vector<char> sieve(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count);
+
+    /**
+     * Optional instrumentation, pass a SieveStats* to any of the sieves.
+     * Timers and counters are updated per phase (marks are counted from the
+     * prime's residue, not per write) so the sieve runs the same code either way
+     * unless tile_groups is changed.
+     */
+    struct SieveStats {
+        // Print progress lines with an ETA to stderr this often (0 = never).
+        double progress_seconds = 0;
+        // Tile groups to stamp, bench_tiles compares 0 to 3.
+        int tile_groups = TILE_GROUPS;
+
+        // Residues and the dense / medium primes (<= gap)
+        double small_seconds = 0;
+        // Primes > gap, at most one mark each
+        double large_seconds = 0;
+        // Odds only to the full interval (the even pass)
+        double expand_seconds = 0;
+        // Left for callers, e.g. converting the result to Python objects
+        double convert_seconds = 0;
+
+        uint64_t small_primes = 0;
+        uint64_t large_primes = 0;
+        // Entries written by each group of primes
+        uint64_t small_marks = 0;
+        uint64_t large_marks = 0;
+        // Most TILE_PRIMES groups stamped by one sieve
+        uint64_t small_tiles = 0;
+    };
+
+    // threads > 1 splits the interval and the large primes between worker threads.
+    std::vector<uint64_t> sieve_factors(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                                        int threads = 1, SieveStats *stats = nullptr);
+    std::vector<char> sieve(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                            int threads = 1, SieveStats *stats = nullptr);
+
+    // Same output but residues are computed from N = m * P# / d + a.
+    std::vector<uint64_t> sieve_factors(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                                        size_t &prime_count, int threads = 1,
+                                        SieveStats *stats = nullptr);
+    std::vector<char> sieve(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                            size_t &prime_count, int threads = 1, SieveStats *stats = nullptr);
+
+    // Only the odd numbers in [N, N+gap], entry i is N + (N even) + 2*i.
+    std::vector<char> sieve_odds(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                                 int threads = 1, SieveStats *stats = nullptr);
+    std::vector<char> sieve_odds(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                                 size_t &prime_count, int threads = 1, SieveStats *stats = nullptr);
+
+    /**
+     * sieve_odds into composite (odd_count(N, gap) entries) in resumable steps.
+     * Primes > gap are applied in ranges, after each checkpoint(last_prime) is
+     * called with composite including every prime <= last_prime.
+     * If resume_after > 0 composite and prime_count must hold what they were
+     * at checkpoint(resume_after) and sieving continues from there.
+     */
+    bool sieve_odds(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                    char *composite, uint64_t resume_after,
+                    const std::function<void(uint64_t)> &checkpoint, int threads = 1,
+                    SieveStats *stats = nullptr);
+    bool sieve_odds(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                    size_t &prime_count, char *composite, uint64_t resume_after,
+                    const std::function<void(uint64_t)> &checkpoint, int threads = 1,
+                    SieveStats *stats = nullptr);
+
+    /**
+     * Same as sieve_odds(forms[k], gaps[k], limits[k]) for each k but the primes
+     * larger than the intervals are enumerated once and shared. An interval
+     * that can't be sieved gives an empty vector. stats is summed over all N.
+     */
+    std::vector<std::vector<char>> sieve_odds_batch(
+        const std::vector<residue::Primorial> &forms,
+        const std::vector<uint64_t> &gaps, const std::vector<uint64_t> &limits,
+        std::vector<size_t> &prime_counts, int threads = 1, SieveStats *stats = nullptr);
+
+    /**
+     * sieve_odds for N_i = (form.m + i) * P# / d + form.a for i in [0, count)
+     * with one pass over the large primes per tile of N_i. K = P#/d mod 2p is
+     * computed once per prime and the N_i that p hits are found with a modular
+     * search, costing O(log p) per hit instead of a residue per N_i.
+     * At most M_RANGE_TILE_BYTES of composites are held at once, on_row(i, N_i,
+     * composite) is called in order of i with odd_count(N_i, gap) entries and
+     * returns false to stop early (sieve_odds_m_range then returns false).
+     * prime_count is for the last N_i (all N_i > limit have the same count).
+     */
+    const uint64_t M_RANGE_TILE_BYTES = 1 << 26;
+    bool sieve_odds_m_range(
+        const residue::Primorial &form, uint64_t count, uint64_t gap, uint64_t limit,
+        size_t &prime_count,
+        const std::function<bool(uint64_t, const mpz_t&, const char*)> &on_row,
+        int threads = 1, SieveStats *stats = nullptr);
+
+    /**
+     * sieve_odds for intervals too large for memory, gap up to MAX_WINDOWED_GAP
+     * and N > limit. The result is a bitmap file at path (bit i of byte i / 8
+     * set if N + first_odd + 2*i is composite) sieved WINDOW_BYTES at a time
+     * through mmap, only one window per thread is mapped at once.
+     *
+     * Primes below a window's span keep their first multiple and are sieved
+     * window by window, larger primes are taken in batches and move between
+     * per window buckets (each marks at most once per window).
+     * on_survivor(offset) is then called in ascending order for each odd
+     * N + offset left in the bitmap, returning false stops early (and the
+     * sieve returns false). The file is left for the caller.
+     */
+    const uint64_t WINDOW_BYTES = 1 << 22;
+    const uint64_t MAX_WINDOWED_GAP = 1ULL << 40;
+    bool sieve_odds_windowed(mpz_t &N, uint64_t gap, uint64_t limit, const std::string &path,
+                             size_t &prime_count,
+                             const std::function<bool(uint64_t)> &on_survivor,
+                             int threads = 1, SieveStats *stats = nullptr);
+    bool sieve_odds_windowed(const residue::Primorial &form, uint64_t gap, uint64_t limit,
+                             const std::string &path, size_t &prime_count,
+                             const std::function<bool(uint64_t)> &on_survivor,
+                             int threads = 1, SieveStats *stats = nullptr);
+
+    /**
+     * sieve_odds of [N, N + gap] that can be continued. extend_limit only
+     * sieves the primes in (limit, new_limit] and extend_interval only the
+     * numbers in (gap, new_gap], the result is the same as sieve_odds with the
+     * final gap and limit. Starts with limit 0 (nothing sieved).
+     *
+     * Redone from scratch when that's needed or cheap: N <= limit (primes in
+     * the interval) or a limit <= gap (primes that hit more than once).
+     */
+    class Session {
+        public:
+            // form (if given) is copied, N = form.value().
+            Session(const mpz_t &N, const residue::Primorial *form, uint64_t gap);
+            ~Session();
+
+            bool extend_limit(uint64_t new_limit, int threads = 1, SieveStats *stats = nullptr);
+            bool extend_interval(uint64_t new_gap, int threads = 1, SieveStats *stats = nullptr);
+
+            uint64_t gap() const { return gap_; }
+            uint64_t limit() const { return limit_; }
+            size_t prime_count() const { return prime_count_; }
+
+            // odd_count(N, gap) entries, entry i is N + (N even) + 2*i.
+            const std::vector<char>& composite() const { return composite_; }
+            // Odd numbers not marked composite.
+            uint64_t survivors() const;
+            // Writes gap + 1 entries with the evens filled in, same as sieve().
+            void expand(char *full) const;
+
+        private:
+            bool resieve(int threads, SieveStats *stats);
+
+            mpz_t N;
+            bool has_form;
+            residue::Primorial form;
+            uint64_t gap_;
+            uint64_t limit_ = 0;
+            size_t prime_count_ = 0;
+            std::vector<char> composite_;
+    };
+
+    // Number of odd numbers in [N, N+gap]
+    uint64_t odd_count(mpz_t &N, uint64_t gap);
+
+    // composite holds sieve_odds output, expand it in place to gap+1 entries.
+    void expand_odds(mpz_t &N, uint64_t gap, char *composite);
+
+    /**
+     * Largest factor of each odd number in [N, N+gap] (0 if none, 1 for 1) as
+     * odd_count(N, gap) uint32s, entry i is N + (N even) + 2*i.
+     * Factors >= LARGE_FACTOR are written as LARGE_FACTOR and (index, factor) is
+     * added to large, sorted by index.
+     */
+    bool sieve_factors_compact(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+                               uint32_t *factors, std::vector<std::pair<uint32_t, uint64_t>> &large,
+                               int threads = 1, SieveStats *stats = nullptr);
+
+    // Writes gap+1 composite flags (0 or 1) into composite without allocating.
+    // Returns false if the sieve failed.
+    bool sieve(mpz_t &N, uint64_t gap, uint64_t limit, size_t &prime_count,
+               char *composite, int threads = 1, SieveStats *stats = nullptr);
+    bool sieve(const residue::Primorial &form, uint64_t gap, uint64_t limit, size_t &prime_count,
+               char *composite, int threads = 1, SieveStats *stats = nullptr);
 }
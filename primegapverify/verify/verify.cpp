@@ -13,8 +13,23 @@
 // limitations under the License.
 
 #include "verify.hpp"
+#include "autotune.hpp"
+#include "certificate.hpp"
+#include "checkpoint.hpp"
+#include "parsenumber.hpp"
+#include "primes.hpp"
+#include "prp.hpp"
 #include "sieve_util.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <gmp.h>
 
 #define PY_SSIZE_T_CLEAN
@@ -26,16 +41,25 @@ const char doc_sieve_interval[] = R"EOF(
 
     Parameters
     ----------
-       N : start of interval
+       N : start of interval, int or gmpy2.mpz (converted in binary),
+           str ("123" or "m * P# / d + a") or little endian bytes
        distance : size of interval
        max_prime : remove all multiples of primes less than or equal
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, filled with per phase timings (small_seconds,
+               large_seconds, expand_seconds, convert_seconds) and counts
+               (small_primes, large_primes, small_marks, large_marks,
+               small_tiles). If it has progress_seconds, progress is printed
+               to stderr that often. convert_seconds is only set by callers
+               that build Python objects (sieve_factor_interval, utils.sieve).
 
     Returns
     -------
-        composites : array
-            Status (composite or unknown) for distance+1 numbers [N, N+distance]
+        composites : bytes
+            Status (1 composite or 0 unknown) for distance+1 numbers [N, N+distance]
             Never removes primes even if max_prime > N. 0 and 1 marked composite.
-
+            Supports the buffer protocol, numpy.frombuffer(composites, numpy.bool_)
+            wraps it without a copy.
 
 )EOF";
 
@@ -47,6 +71,8 @@ const char doc_sieve_factor_interval[] = R"EOF(
        N : start of interval
        distance : size of interval
        max_prime : remove all multiples of primes less than or equal
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval
 
     Returns
     -------
@@ -56,6 +82,198 @@ const char doc_sieve_factor_interval[] = R"EOF(
 
 )EOF";
 
+const char doc_sieve_factor_interval_compact[] = R"EOF(
+    Sieve an interval of numbers, compact version of sieve_factor_interval
+
+    Parameters
+    ----------
+       N : start of interval
+       distance : size of interval
+       max_prime : remove all multiples of primes less than or equal
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval
+
+    Returns
+    -------
+        (first_odd, factors, large) : tuple
+            Only odd numbers are included (evens all have factor 2),
+            entry i is N + first_odd + 2*i.
+            factors : bytes of native uint32 (memoryview(factors).cast('I'))
+                Largest factor found or 0, 1 for the number 1.
+                4294967295 if the factor is >= 2^32, see large.
+            large : bytes of native uint64 (index, factor) pairs sorted by index
+                for entries with a factor >= 2^32.
+
+)EOF";
+
+const char doc_sieve_primorial_interval[] = R"EOF(
+    Sieve an interval of numbers starting at N = m * P# / d + a
+
+    Same as sieve_interval(N, ...) but residues are computed from m, P, d, a
+    which avoids big integer math for primes <= P.
+
+    Parameters
+    ----------
+       m, P, d, a : N = m * P# / d + a, d must divide P#
+       distance : size of interval
+       max_prime : remove all multiples of primes less than or equal
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval
+
+    Returns
+    -------
+        composites : bytes
+            Status (1 composite or 0 unknown) for distance+1 numbers [N, N+distance]
+
+)EOF";
+
+const char doc_sieve_primorial_range[] = R"EOF(
+    Sieve intervals starting at N_i = (m + i) * P# / d + a for i in [0, count)
+
+    Same as sieve_primorial_interval for each N_i but every prime's residue
+    is computed once for all of them (the N_i each prime divides are found with
+    a modular search). Holds at most 64MB of intervals while sieving.
+
+    Parameters
+    ----------
+       m, count, P, d, a : N_i = (m + i) * P# / d + a, d must divide P#
+       distance : size of each interval
+       max_prime : remove all multiples of primes less than or equal
+       on_row : called as on_row(i, composites) in order of i, composites
+                (bytes) is the status (1 composite or 0 unknown) of the
+                distance+1 numbers [N_i, N_i+distance]. An exception stops
+                the sieve and is raised.
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval
+
+    Returns
+    -------
+        None
+
+)EOF";
+
+const char doc_sieve_primorial_batch[] = R"EOF(
+    Sieve intervals starting at N_k = m_k * P_k# / d_k + a_k for each record
+
+    Same as sieve_primorial_interval for each record but the primes larger
+    than every interval are enumerated once and shared (large_sieve --batch).
+
+    Parameters
+    ----------
+       records : sequence of (m, P, d, a, distance, max_prime) tuples
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval (summed over all records)
+
+    Returns
+    -------
+        composites : list
+            bytes like sieve_primorial_interval for each record, None if the
+            record can't be sieved (d doesn't divide P#, N < 0)
+
+)EOF";
+
+const char doc_sieve_interval_windowed[] = R"EOF(
+    Sieve [N, N+distance] for distance up to 2^40 into a bitmap file, a window
+    at a time so memory use doesn't grow with distance.
+
+    Parameters
+    ----------
+       N : start of interval, must be larger than max_prime
+       distance : size of interval
+       max_prime : remove all multiples of primes less than or equal
+       path : file for the bitmap, bit i (of byte i // 8, lowest bit first) is
+              set if N + (N even) + 2*i is composite, evens aren't stored
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval
+       on_offsets : optional, called in order with lists of up to 65536
+                    ascending offsets of the odd numbers left. An exception
+                    stops the scan and is raised.
+
+    Returns
+    -------
+        count : int
+            number of odd numbers left (clear bits)
+
+)EOF";
+
+const char doc_write_prime_table[] = R"EOF(
+    Write the primes up to limit to a prime table file (mod 30 wheel bitmap,
+    ~33MB per 10^9). With $PRIMEGAPVERIFY_PRIMES set to the file every sieve
+    reads its primes from one shared mapping of it instead of sieving them.
+
+    Parameters
+    ----------
+       path : file to write
+       limit : largest number covered
+
+)EOF";
+
+const char doc_generate_certificate[] = R"EOF(
+    validate_interval and write a certificate of the result to path, see
+    check_certificate.
+
+    Parameters
+    ----------
+       N : start of interval, int or str (decimal or m * P# / d + a, which is
+           kept in the certificate)
+       distance : size of interval
+       max_prime : sieve limit
+       path : file to write the certificate to (only if the gap is valid)
+       threads : number of threads to sieve and PRP test with (default 1)
+
+    Returns
+    -------
+        offset : int or None
+            None if the gap is valid, else the offset of the first problem found.
+
+)EOF";
+
+const char doc_check_certificate[] = R"EOF(
+    Check a certificate written by generate_certificate without sieving.
+
+    Every interior factor claim is verified (one residue of N per distinct
+    factor), every odd interior number must have a claim or be listed as PRP
+    tested, the endpoints are PRP tested and each listed interior number is
+    shown composite with one base 2 Fermat test.
+
+    Parameters
+    ----------
+       path : certificate file
+       threads : number of threads (default 1)
+       prp : retest the listed interior numbers with full PRP tests instead
+             (as slow as the original PRP tests, default False)
+
+    Returns
+    -------
+        None if the certificate is valid, else (offset, reason) of the first
+        problem found (offset is distance + 1 if the file is malformed).
+
+)EOF";
+
+const char doc_validate_interval[] = R"EOF(
+    Validate N and N+distance are prime and the interior is composite
+    by sieving then PRP testing (mpz_probab_prime_p) the unknowns.
+
+    Parameters
+    ----------
+       N : start of interval
+       distance : size of interval
+       max_prime : sieve limit
+       threads : number of threads to sieve and PRP test with (default 1)
+       checkpoint : path to save progress to every minute and resume from
+                    if it holds progress for the same N, distance, max_prime
+       stats : optional dict, see sieve_interval (sieve timings only)
+
+    Returns
+    -------
+        offset : int or None
+            None if the gap is valid, else the offset of the first problem found
+            (0 or distance if an endpoint isn't prime, or an interior prime).
+            Endpoints are tested first, then the interior from both ends, all
+            threads stop at the first interior prime.
+
+)EOF";
+
 const char doc_sieve_limit[] = R"EOF(
     Determine a reasonable max prime for sieve_interval
 
@@ -63,6 +281,14 @@ const char doc_sieve_limit[] = R"EOF(
     ----------
        log2_n : Number of bits in N
        gap: size of interval
+       autotune : if True pick the limit that minimizes sieve + PRP time from
+                  this machine's measured speeds (default False, fixed formula).
+                  Measurements are cached per (bits, backend) in
+                  ~/.cache/primegapverify_costs.txt (or $PRIMEGAPVERIFY_COSTS).
+       backend : name of the PRP test the survivors get (default "gmp")
+       measure_prp : callable returning seconds for one PRP test of a log2_n bit
+                     composite, required unless backend is "gmp". Only called
+                     when the cache has no entry.
 
     Returns
     -------
@@ -70,25 +296,179 @@ const char doc_sieve_limit[] = R"EOF(
            Reasonable prime to pass to sieve_interval
 )EOF";
 
+const char doc_sieve_session[] = R"EOF(
+    Sieve(start, distance, max_prime=0, threads=1, stats=None)
+
+    Sieve of [start, start+distance] that can be extended in place, the result
+    always matches sieve_interval(start, distance, max_prime) for the current
+    distance and max_prime.
+
+    Parameters
+    ----------
+       start : int or str, a str in m * P# / d + a form keeps the residue speedup
+       distance : size of interval
+       max_prime : sieve limit to start with (default 0, nothing sieved)
+       threads : number of threads to sieve with (default 1)
+       stats : optional dict, see sieve_interval
+
+    Methods
+    -------
+       extend_limit(max_prime, stats=None) : only sieves primes above the old limit
+       extend_interval(distance, stats=None) : only sieves the new numbers
+       survivors() : count of numbers not known to be composite
+       composites() : bytes, same as sieve_interval returns
+
+    Attributes
+    ----------
+       distance, max_prime, prime_count
+
+)EOF";
+
+
+// How often validate_interval saves its checkpoint.
+const double CHECKPOINT_SECONDS = 60;
+
+// Little endian bytes of the magnitude, no decimal conversion.
+int set_mpz_from_bytes(mpz_t &n, const void *data, size_t length) {
+    mpz_import(n, length, -1, 1, 0, 0, data);
+    return 0;
+}
+
+int set_mpz_from_int(mpz_t &n, PyObject* num) {
+    // Accepts int and anything with __index__ (e.g. gmpy2.mpz).
+    PyObject* value = PyNumber_Index(num);
+    if (value == NULL)
+        return -1;
+
+    PyObject* zero = PyLong_FromLong(0);
+    int negative = PyObject_RichCompareBool(value, zero, Py_LT);
+    Py_DECREF(zero);
+    PyObject* magnitude = PyNumber_Absolute(value);
+    Py_DECREF(value);
+    if (negative < 0 || magnitude == NULL) {
+        Py_XDECREF(magnitude);
+        return -1;
+    }
+
+    size_t bits = _PyLong_NumBits(magnitude);
+    std::vector<unsigned char> bytes(bits / 8 + 1);
+    int error = _PyLong_AsByteArray(
+        (PyLongObject*) magnitude, bytes.data(), bytes.size(),
+        /* little_endian */ 1, /* is_signed */ 0
+#if PY_VERSION_HEX >= 0x030D0000
+        , /* with_exceptions */ 1
+#endif
+        );
+    Py_DECREF(magnitude);
+    if (error)
+        return -1;
+
+    set_mpz_from_bytes(n, bytes.data(), bytes.size());
+    if (negative)
+        mpz_neg(n, n);
+    return 0;
+}
 
 int set_mpz_from_int_str(mpz_t &n, PyObject* n_str) {
-    // Probably works for both int & str input.
+    if (PyLong_Check(n_str) || (!PyUnicode_Check(n_str) && PyIndex_Check(n_str)))
+        return set_mpz_from_int(n, n_str);
+
+    if (PyObject_CheckBuffer(n_str)) {
+        Py_buffer view;
+        if (PyObject_GetBuffer(n_str, &view, PyBUF_SIMPLE))
+            return -1;
+        set_mpz_from_bytes(n, view.buf, view.len);
+        PyBuffer_Release(&view);
+        return 0;
+    }
+
     PyObject* s = PyObject_Str(n_str);
-    PyObject* bytes = PyUnicode_AsEncodedString(s, "utf-8", "?");
-    if (bytes == NULL) {
-        Py_XDECREF(s);
+    if (s == NULL)
+        return -1;
+    const char *str = PyUnicode_AsUTF8(s);
+    if (str == NULL) {
+        Py_DECREF(s);
         return -1;
     }
 
-    mpz_set_str(n, PyBytes_AS_STRING(bytes), 10);
+    int error = mpz_set_str(n, str, 10);
+    if (error) {
+        // Try m * P# / d + a without expanding to decimal
+        residue::Primorial form;
+        if (parsenumber::parse_primorial_standard_form(str, form) && form.value(n))
+            error = 0;
+    }
 
-    Py_XDECREF(s);
-    Py_XDECREF(bytes);
-    return 0;
+    Py_DECREF(s);
+    return error;
 }
 
+/**
+ * stats_dict is None or a dict to fill with sieve_util::SieveStats. Sets
+ * stats_ptr to stats (reading progress_seconds) or nullptr.
+ */
 bool
-check_sieve_args(uint64_t gap, uint64_t max_prime)
+init_stats(PyObject *stats_dict, sieve_util::SieveStats &stats, sieve_util::SieveStats *&stats_ptr)
+{
+    stats_ptr = nullptr;
+    if (stats_dict == NULL || stats_dict == Py_None)
+        return true;
+
+    if (!PyDict_Check(stats_dict)) {
+        PyErr_Format(PyExc_TypeError, "stats must be a dict");
+        return false;
+    }
+
+    PyObject *progress = PyDict_GetItemString(stats_dict, "progress_seconds");
+    if (progress) {
+        stats.progress_seconds = PyFloat_AsDouble(progress);
+        if (PyErr_Occurred())
+            return false;
+    }
+    stats_ptr = &stats;
+    return true;
+}
+
+bool
+fill_stats(PyObject *stats_dict, const sieve_util::SieveStats *stats)
+{
+    if (stats == nullptr)
+        return true;
+
+    const std::pair<const char*, double> seconds[] = {
+        {"small_seconds", stats->small_seconds},
+        {"large_seconds", stats->large_seconds},
+        {"expand_seconds", stats->expand_seconds},
+        {"convert_seconds", stats->convert_seconds},
+    };
+    const std::pair<const char*, uint64_t> counts[] = {
+        {"small_primes", stats->small_primes},
+        {"large_primes", stats->large_primes},
+        {"small_marks", stats->small_marks},
+        {"large_marks", stats->large_marks},
+        {"small_tiles", stats->small_tiles},
+    };
+    for (auto &entry : seconds) {
+        PyObject *value = PyFloat_FromDouble(entry.second);
+        if (value == NULL || PyDict_SetItemString(stats_dict, entry.first, value)) {
+            Py_XDECREF(value);
+            return false;
+        }
+        Py_DECREF(value);
+    }
+    for (auto &entry : counts) {
+        PyObject *value = PyLong_FromUnsignedLongLong(entry.second);
+        if (value == NULL || PyDict_SetItemString(stats_dict, entry.first, value)) {
+            Py_XDECREF(value);
+            return false;
+        }
+        Py_DECREF(value);
+    }
+    return true;
+}
+
+bool
+check_sieve_args(uint64_t gap, uint64_t max_prime, int threads)
 {
     if (max_prime == 0 || max_prime >= 1'000'000'000'000) {
         PyErr_Format(PyExc_ValueError, "bad max_prime(%d)", max_prime);
@@ -100,6 +480,11 @@ check_sieve_args(uint64_t gap, uint64_t max_prime)
         return false;
     }
 
+    if (threads < 1 || threads > 1024) {
+        PyErr_Format(PyExc_ValueError, "bad threads(%d)", threads);
+        return false;
+    }
+
     return true;
 }
 
@@ -125,65 +510,618 @@ sieve_factor_interval(PyObject *self, PyObject *args)
     PyObject *start;
     uint64_t gap;
     uint64_t max_prime;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTuple(args, "OLL|iO", &start, &gap, &max_prime, &threads, &stats_dict))
+        return NULL;
 
-    if (!PyArg_ParseTuple(args, "OLL", &start, &gap, &max_prime))
+    if (!check_sieve_args(gap, max_prime, threads))
         return NULL;
 
-    if (!check_sieve_args(gap, max_prime))
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
         return NULL;
 
-    // XXX: Silly to roundtrip this through a str, but it works.
     mpz_t n;
     if (!init_and_check_n(n, start))
         return NULL;
 
     size_t prime_count;
-    auto factors = sieve_util::sieve_factors(n, gap, max_prime, prime_count);
+    std::vector<uint64_t> factors;
+    Py_BEGIN_ALLOW_THREADS
+    factors = sieve_util::sieve_factors(n, gap, max_prime, prime_count, threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+    mpz_clear(n);
     if (factors.empty()) {
-        PyErr_Format(PyExc_ValueError, "sieve failed");
+        return PyErr_Format(PyExc_ValueError, "sieve failed");
     }
 
+    auto t0 = std::chrono::steady_clock::now();
     PyObject* pylist = PyList_New( factors.size() );
     for (size_t i = 0; i < factors.size(); i++) {
         PyList_SET_ITEM(pylist, i, PyLong_FromLong(factors[i]));
     }
+    stats.convert_seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - t0).count();
+
+    if (!fill_stats(stats_dict, stats_ptr)) {
+        Py_DECREF(pylist);
+        return NULL;
+    }
 
     // XXX: Convert to new tuple object and return that.
     return pylist;
 }
 
 
+PyObject*
+sieve_factor_interval_compact(PyObject *self, PyObject *args)
+{
+    PyObject *start;
+    uint64_t gap;
+    uint64_t max_prime;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTuple(args, "OLL|iO", &start, &gap, &max_prime, &threads, &stats_dict))
+        return NULL;
+
+    if (!check_sieve_args(gap, max_prime, threads))
+        return NULL;
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    mpz_t n;
+    if (!init_and_check_n(n, start))
+        return NULL;
+
+    const long first_odd = mpz_even_p(n) ? 1 : 0;
+    PyObject* factors = PyBytes_FromStringAndSize(
+        NULL, sieve_util::odd_count(n, gap) * sizeof(uint32_t));
+    if (factors == NULL) {
+        mpz_clear(n);
+        return NULL;
+    }
+
+    size_t prime_count;
+    bool success;
+    std::vector<std::pair<uint32_t, uint64_t>> large;
+    uint32_t *buffer = (uint32_t*) PyBytes_AS_STRING(factors);
+    Py_BEGIN_ALLOW_THREADS
+    success = sieve_util::sieve_factors_compact(n, gap, max_prime, prime_count, buffer, large,
+                                                threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+    mpz_clear(n);
+    if (!success) {
+        Py_DECREF(factors);
+        return PyErr_Format(PyExc_ValueError, "sieve failed");
+    }
+
+    std::vector<uint64_t> pairs;
+    pairs.reserve(2 * large.size());
+    for (auto &entry : large) {
+        pairs.push_back(entry.first);
+        pairs.push_back(entry.second);
+    }
+    PyObject* large_bytes = PyBytes_FromStringAndSize(
+        (const char*) pairs.data(), pairs.size() * sizeof(uint64_t));
+    if (large_bytes == NULL || !fill_stats(stats_dict, stats_ptr)) {
+        Py_DECREF(factors);
+        Py_XDECREF(large_bytes);
+        return NULL;
+    }
+
+    return Py_BuildValue("(lNN)", first_odd, factors, large_bytes);
+}
+
+
 PyObject*
 sieve_interval(PyObject *self, PyObject *args)
 {
     PyObject *start;
     uint64_t gap;
     uint64_t max_prime;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTuple(args, "OLL|iO", &start, &gap, &max_prime, &threads, &stats_dict))
+        return NULL;
 
-    if (!PyArg_ParseTuple(args, "OLL", &start, &gap, &max_prime))
+    if (!check_sieve_args(gap, max_prime, threads))
         return NULL;
 
-    if (!check_sieve_args(gap, max_prime))
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
         return NULL;
 
-    // XXX: Silly to roundtrip this through a str, but it works.
     mpz_t n;
     if (!init_and_check_n(n, start))
         return NULL;
 
+    // Sieve directly into the result, no other copy of the interval is made.
+    PyObject* composites = PyBytes_FromStringAndSize(NULL, gap + 1);
+    if (composites == NULL) {
+        mpz_clear(n);
+        return NULL;
+    }
+
     size_t prime_count;
-    auto composites = sieve_util::sieve(n, gap, max_prime, prime_count);
-    if (composites.empty()) {
-        PyErr_Format(PyExc_ValueError, "sieve failed");
+    bool success;
+    char *buffer = PyBytes_AS_STRING(composites);
+    Py_BEGIN_ALLOW_THREADS
+    success = sieve_util::sieve(n, gap, max_prime, prime_count, buffer, threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+    mpz_clear(n);
+    if (!success) {
+        Py_DECREF(composites);
+        return PyErr_Format(PyExc_ValueError, "sieve failed");
     }
+    if (!fill_stats(stats_dict, stats_ptr)) {
+        Py_DECREF(composites);
+        return NULL;
+    }
+
+    return composites;
+}
+
+
+PyObject*
+sieve_primorial_interval(PyObject *self, PyObject *args)
+{
+    residue::Primorial form;
+    uint64_t gap;
+    uint64_t max_prime;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
 
-    PyObject* pylist = PyList_New( composites.size() );
-    for (size_t i = 0; i < composites.size(); i++) {
-        PyList_SET_ITEM(pylist, i, PyBool_FromLong(composites[i]));
+    if (!PyArg_ParseTuple(args, "KKKLLL|iO", &form.m, &form.P, &form.d, &form.a,
+                          &gap, &max_prime, &threads, &stats_dict))
+        return NULL;
+
+    if (!check_sieve_args(gap, max_prime, threads))
+        return NULL;
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    if (form.m == 0 || form.P < 2 || form.P > 10'000'000 || form.d == 0) {
+        return PyErr_Format(PyExc_ValueError, "bad m(%llu), P(%llu) or d(%llu)",
+                            form.m, form.P, form.d);
     }
 
-    // XXX: Convert to new tuple object and return that.
-    return pylist;
+    PyObject* composites = PyBytes_FromStringAndSize(NULL, gap + 1);
+    if (composites == NULL)
+        return NULL;
+
+    size_t prime_count;
+    bool success;
+    char *buffer = PyBytes_AS_STRING(composites);
+    Py_BEGIN_ALLOW_THREADS
+    success = sieve_util::sieve(form, gap, max_prime, prime_count, buffer, threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+    if (!success) {
+        Py_DECREF(composites);
+        return PyErr_Format(PyExc_ValueError, "sieve failed (d must divide P#, N >= 0)");
+    }
+    if (!fill_stats(stats_dict, stats_ptr)) {
+        Py_DECREF(composites);
+        return NULL;
+    }
+    return composites;
+}
+
+
+PyObject*
+sieve_primorial_range(PyObject *self, PyObject *args)
+{
+    residue::Primorial form;
+    uint64_t count;
+    uint64_t gap;
+    uint64_t max_prime;
+    PyObject *on_row;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTuple(args, "KKKKLLLO|iO", &form.m, &count, &form.P, &form.d, &form.a,
+                          &gap, &max_prime, &on_row, &threads, &stats_dict))
+        return NULL;
+
+    if (!check_sieve_args(gap, max_prime, threads))
+        return NULL;
+
+    if (form.m == 0 || form.P < 2 || form.P > 10'000'000 || form.d == 0) {
+        return PyErr_Format(PyExc_ValueError, "bad m(%llu), P(%llu) or d(%llu)",
+                            form.m, form.P, form.d);
+    }
+
+    if (count == 0 || form.m + count < form.m) {
+        return PyErr_Format(PyExc_ValueError, "bad count(%llu)", count);
+    }
+
+    if (!PyCallable_Check(on_row)) {
+        PyErr_Format(PyExc_TypeError, "on_row must be callable");
+        return NULL;
+    }
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    // One row at a time, the GIL is only held while on_row runs.
+    std::vector<char> row_buffer(gap + 1);
+    size_t prime_count;
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    auto row_callback = [&](uint64_t i, const mpz_t &N_i, const char *row) {
+        mpz_t temp;
+        mpz_init_set(temp, N_i);
+        std::copy_n(row, sieve_util::odd_count(temp, gap), row_buffer.data());
+        sieve_util::expand_odds(temp, gap, row_buffer.data());
+        mpz_clear(temp);
+
+        Py_BLOCK_THREADS
+        PyObject *result = NULL;
+        PyObject *composites = PyBytes_FromStringAndSize(row_buffer.data(), row_buffer.size());
+        if (composites != NULL)
+            result = PyObject_CallFunction(on_row, "KN", i, composites);
+        Py_XDECREF(result);
+        Py_UNBLOCK_THREADS
+        return result != NULL;
+    };
+    success = sieve_util::sieve_odds_m_range(form, count, gap, max_prime, prime_count,
+                                             row_callback, threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+    if (PyErr_Occurred())
+        return NULL;
+    if (!success) {
+        return PyErr_Format(PyExc_ValueError, "sieve failed (d must divide P#, N >= 0)");
+    }
+    if (!fill_stats(stats_dict, stats_ptr))
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+sieve_primorial_batch(PyObject *self, PyObject *args)
+{
+    PyObject *records;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTuple(args, "O|iO", &records, &threads, &stats_dict))
+        return NULL;
+
+    PyObject *seq = PySequence_Fast(records, "records must be a sequence");
+    if (seq == NULL)
+        return NULL;
+
+    const Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    std::vector<residue::Primorial> forms(count);
+    std::vector<uint64_t> gaps(count);
+    std::vector<uint64_t> limits(count);
+    for (Py_ssize_t k = 0; k < count; k++) {
+        residue::Primorial &form = forms[k];
+        PyObject *record = PySequence_Fast_GET_ITEM(seq, k);
+        if (!PyTuple_Check(record)) {
+            Py_DECREF(seq);
+            PyErr_Format(PyExc_TypeError, "record %zd must be a tuple", k);
+            return NULL;
+        }
+        if (!PyArg_ParseTuple(record, "KKKLLL", &form.m, &form.P, &form.d, &form.a,
+                              &gaps[k], &limits[k])
+                || !check_sieve_args(gaps[k], limits[k], threads)) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+        if (form.m == 0 || form.P < 2 || form.P > 10'000'000 || form.d == 0) {
+            Py_DECREF(seq);
+            return PyErr_Format(PyExc_ValueError, "bad m(%llu), P(%llu) or d(%llu)",
+                                form.m, form.P, form.d);
+        }
+    }
+    Py_DECREF(seq);
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    std::vector<size_t> prime_counts;
+    std::vector<std::vector<char>> odds;
+    Py_BEGIN_ALLOW_THREADS
+    odds = sieve_util::sieve_odds_batch(forms, gaps, limits, prime_counts, threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+
+    PyObject *result = PyList_New(count);
+    if (result == NULL)
+        return NULL;
+
+    mpz_t N;
+    mpz_init(N);
+    for (Py_ssize_t k = 0; k < count; k++) {
+        if (odds[k].empty()) {
+            Py_INCREF(Py_None);
+            PyList_SET_ITEM(result, k, Py_None);
+            continue;
+        }
+        PyObject *composites = PyBytes_FromStringAndSize(NULL, gaps[k] + 1);
+        if (composites == NULL) {
+            mpz_clear(N);
+            Py_DECREF(result);
+            return NULL;
+        }
+        char *buffer = PyBytes_AS_STRING(composites);
+        forms[k].value(N);
+        std::copy(odds[k].begin(), odds[k].end(), buffer);
+        std::vector<char>().swap(odds[k]);
+        sieve_util::expand_odds(N, gaps[k], buffer);
+        PyList_SET_ITEM(result, k, composites);
+    }
+    mpz_clear(N);
+
+    if (!fill_stats(stats_dict, stats_ptr)) {
+        Py_DECREF(result);
+        return NULL;
+    }
+    return result;
+}
+
+
+PyObject*
+validate_interval(PyObject *self, PyObject *args)
+{
+    PyObject *start;
+    uint64_t gap;
+    uint64_t max_prime;
+    int threads = 1;
+    const char *checkpoint_path = NULL;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTuple(args, "OLL|izO", &start, &gap, &max_prime, &threads, &checkpoint_path,
+                          &stats_dict))
+        return NULL;
+
+    if (!check_sieve_args(gap, max_prime, threads))
+        return NULL;
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    mpz_t n;
+    if (!init_and_check_n(n, start))
+        return NULL;
+
+    size_t prime_count;
+    bool success;
+    prp::GapResult result;
+    Py_BEGIN_ALLOW_THREADS
+    // Without a path nothing is saved.
+    checkpoint::Checkpointer ckpt(checkpoint_path ? checkpoint_path : "", CHECKPOINT_SECONDS,
+                                  n, gap, max_prime);
+    success = ckpt.sieve(n, nullptr, prime_count, threads, stats_ptr);
+    if (success) {
+        result = ckpt.test_gap(n, threads);
+    }
+    Py_END_ALLOW_THREADS
+    mpz_clear(n);
+    if (!success) {
+        return PyErr_Format(PyExc_ValueError, "sieve failed");
+    }
+    if (!fill_stats(stats_dict, stats_ptr))
+        return NULL;
+
+    if (result.verified) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromUnsignedLongLong(result.failed_offset);
+}
+
+
+PyObject*
+sieve_interval_windowed(PyObject *self, PyObject *args)
+{
+    PyObject *start;
+    uint64_t gap;
+    uint64_t max_prime;
+    const char *path;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+    PyObject *on_offsets = Py_None;
+
+    if (!PyArg_ParseTuple(args, "OLLs|iOO", &start, &gap, &max_prime, &path, &threads,
+                          &stats_dict, &on_offsets))
+        return NULL;
+
+    // check_sieve_args but gap can be larger.
+    if (gap > sieve_util::MAX_WINDOWED_GAP || !check_sieve_args(1, max_prime, threads))
+        return PyErr_Format(PyExc_ValueError, "bad gap(%llu) or arguments", gap);
+
+    if (on_offsets != Py_None && !PyCallable_Check(on_offsets)) {
+        PyErr_Format(PyExc_TypeError, "on_offsets must be callable");
+        return NULL;
+    }
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    mpz_t n;
+    if (!init_and_check_n(n, start)) {
+        mpz_clear(n);
+        return NULL;
+    }
+
+    // Survivors are handed to on_offsets in lists of up to CHUNK, the GIL is
+    // only held while a list is built and passed.
+    const size_t CHUNK = 1 << 16;
+    std::vector<uint64_t> chunk;
+    size_t prime_count;
+    uint64_t count = 0;
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    auto flush = [&]() {
+        Py_BLOCK_THREADS
+        PyObject *result = NULL;
+        PyObject *offsets = PyList_New(chunk.size());
+        for (size_t i = 0; offsets != NULL && i < chunk.size(); i++) {
+            PyObject *offset = PyLong_FromUnsignedLongLong(chunk[i]);
+            if (offset == NULL) {
+                Py_CLEAR(offsets);
+                break;
+            }
+            PyList_SET_ITEM(offsets, i, offset);
+        }
+        if (offsets != NULL)
+            result = PyObject_CallFunctionObjArgs(on_offsets, offsets, NULL);
+        Py_XDECREF(offsets);
+        Py_XDECREF(result);
+        Py_UNBLOCK_THREADS
+        chunk.clear();
+        return result != NULL;
+    };
+    auto on_survivor = [&](uint64_t offset) {
+        count++;
+        if (on_offsets == Py_None)
+            return true;
+        chunk.push_back(offset);
+        return chunk.size() < CHUNK || flush();
+    };
+    success = sieve_util::sieve_odds_windowed(n, gap, max_prime, path, prime_count,
+                                              on_survivor, threads, stats_ptr);
+    if (success && !chunk.empty())
+        success = flush();
+    Py_END_ALLOW_THREADS
+    mpz_clear(n);
+    if (PyErr_Occurred())
+        return NULL;
+    if (!success) {
+        return PyErr_Format(PyExc_ValueError, "sieve failed (start must be > max_prime)");
+    }
+    if (!fill_stats(stats_dict, stats_ptr))
+        return NULL;
+
+    return PyLong_FromUnsignedLongLong(count);
+}
+
+
+PyObject*
+write_prime_table(PyObject *self, PyObject *args)
+{
+    const char *path;
+    uint64_t limit;
+
+    if (!PyArg_ParseTuple(args, "sK", &path, &limit))
+        return NULL;
+
+    if (limit < 30 || limit > 1'000'000'000'000) {
+        return PyErr_Format(PyExc_ValueError, "bad limit(%llu)", limit);
+    }
+
+    bool success;
+    Py_BEGIN_ALLOW_THREADS
+    success = primes::write_table(path, limit);
+    Py_END_ALLOW_THREADS
+    if (!success) {
+        return PyErr_Format(PyExc_OSError, "can't write prime table to %s", path);
+    }
+    Py_RETURN_NONE;
+}
+
+
+PyObject*
+generate_certificate(PyObject *self, PyObject *args)
+{
+    PyObject *start;
+    uint64_t gap;
+    uint64_t max_prime;
+    const char *path;
+    int threads = 1;
+
+    if (!PyArg_ParseTuple(args, "OLLs|i", &start, &gap, &max_prime, &path, &threads))
+        return NULL;
+
+    if (!check_sieve_args(gap, max_prime, threads))
+        return NULL;
+
+    // Standard form is kept so check_certificate can use it.
+    std::string N_str;
+    mpz_t n;
+    if (!init_and_check_n(n, start))
+        return NULL;
+    if (PyUnicode_Check(start)) {
+        N_str = PyUnicode_AsUTF8(start);
+        if (!certificate::parse_N(N_str, n))
+            N_str.clear();
+    }
+    if (N_str.empty()) {
+        char *digits = mpz_get_str(NULL, 10, n);
+        N_str = digits;
+        void (*free_func)(void *, size_t);
+        mp_get_memory_functions(nullptr, nullptr, &free_func);
+        free_func(digits, N_str.size() + 1);
+    }
+    mpz_clear(n);
+
+    certificate::Certificate cert;
+    prp::GapResult result;
+    bool saved = true;
+    Py_BEGIN_ALLOW_THREADS
+    result = certificate::generate(N_str, gap, max_prime, threads, cert);
+    if (result.verified) {
+        saved = certificate::save(path, cert);
+    }
+    Py_END_ALLOW_THREADS
+    if (!result.verified && result.failed_offset > gap) {
+        return PyErr_Format(PyExc_ValueError, "sieve failed");
+    }
+    if (!saved) {
+        return PyErr_Format(PyExc_OSError, "can't write certificate to %s", path);
+    }
+
+    if (result.verified) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromUnsignedLongLong(result.failed_offset);
+}
+
+
+PyObject*
+check_certificate(PyObject *self, PyObject *args)
+{
+    const char *path;
+    int threads = 1;
+    int prp = 0;
+
+    if (!PyArg_ParseTuple(args, "s|ip", &path, &threads, &prp))
+        return NULL;
+
+    if (threads < 1 || threads > 1024) {
+        return PyErr_Format(PyExc_ValueError, "bad threads(%d)", threads);
+    }
+
+    certificate::Certificate cert;
+    bool loaded;
+    certificate::CheckResult result;
+    Py_BEGIN_ALLOW_THREADS
+    loaded = certificate::load(path, cert);
+    if (loaded) {
+        result = certificate::check(cert, threads, prp);
+    }
+    Py_END_ALLOW_THREADS
+    if (!loaded) {
+        return PyErr_Format(PyExc_ValueError, "can't read certificate from %s", path);
+    }
+
+    if (result.valid) {
+        Py_RETURN_NONE;
+    }
+    return Py_BuildValue("Ks", (unsigned long long) result.failed_offset, result.reason);
 }
 
 
@@ -192,8 +1130,11 @@ sieve_limit(PyObject *self, PyObject *args)
 {
     double n_bits;
     int gap;
+    int autotune = 0;
+    const char *backend = "gmp";
+    PyObject *measure_prp = NULL;
 
-    if (!PyArg_ParseTuple(args, "di", &n_bits, &gap))
+    if (!PyArg_ParseTuple(args, "di|psO", &n_bits, &gap, &autotune, &backend, &measure_prp))
         return NULL;
 
     if (n_bits < 1 || n_bits > 1'000'000) {
@@ -204,5 +1145,242 @@ sieve_limit(PyObject *self, PyObject *args)
         return PyErr_Format(PyExc_ValueError, "bad gap(%d)", gap);
     }
 
+    if (autotune) {
+        std::function<double()> measure;
+        if (measure_prp && measure_prp != Py_None) {
+            if (!PyCallable_Check(measure_prp)) {
+                return PyErr_Format(PyExc_TypeError, "measure_prp must be callable");
+            }
+            // Called with the GIL released.
+            measure = [measure_prp]() {
+                PyGILState_STATE gil = PyGILState_Ensure();
+                PyObject *result = PyObject_CallObject(measure_prp, NULL);
+                double seconds = result ? PyFloat_AsDouble(result) : -1;
+                Py_XDECREF(result);
+                PyGILState_Release(gil);
+                return seconds;
+            };
+        } else if (strcmp(backend, "gmp") != 0) {
+            return PyErr_Format(PyExc_ValueError, "backend(%s) needs measure_prp", backend);
+        }
+
+        // Measuring takes seconds, other threads can run meanwhile.
+        autotune::Costs costs;
+        bool measured;
+        std::string backend_str = backend;
+        Py_BEGIN_ALLOW_THREADS
+        measured = autotune::get_costs(
+            autotune::default_cache_path(), backend_str, (uint32_t) n_bits + 1, costs, measure);
+        Py_END_ALLOW_THREADS
+        if (PyErr_Occurred())
+            return NULL;
+        if (measured)
+            return PyLong_FromUnsignedLongLong(autotune::optimal_sievelimit(gap, costs));
+        // Too small to measure, use the formula.
+    }
+
     return PyLong_FromLong(sieve_util::calculate_sievelimit(n_bits, gap));
 }
+
+
+typedef struct {
+    PyObject_HEAD
+    sieve_util::Session *session;
+    int threads;
+    // Set while the GIL is released in extend_*.
+    bool busy;
+} SieveObject;
+
+static void
+Sieve_dealloc(SieveObject *self)
+{
+    delete self->session;
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static bool
+Sieve_ready(SieveObject *self)
+{
+    if (self->session == nullptr) {
+        PyErr_Format(PyExc_ValueError, "Sieve not initialized");
+        return false;
+    }
+    if (self->busy) {
+        PyErr_Format(PyExc_RuntimeError, "Sieve is being extended in another thread");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Runs session->extend_limit or extend_interval (limit == true) without the GIL.
+ */
+static PyObject*
+Sieve_extend(SieveObject *self, PyObject *args, bool limit)
+{
+    uint64_t value;
+    PyObject *stats_dict = NULL;
+    if (!PyArg_ParseTuple(args, "K|O", &value, &stats_dict))
+        return NULL;
+
+    if (!Sieve_ready(self))
+        return NULL;
+
+    if (limit ? !check_sieve_args(1, value, 1) : !check_sieve_args(value, 1, 1))
+        return NULL;
+
+    sieve_util::SieveStats stats, *stats_ptr;
+    if (!init_stats(stats_dict, stats, stats_ptr))
+        return NULL;
+
+    bool success;
+    sieve_util::Session *session = self->session;
+    int threads = self->threads;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    success = limit ? session->extend_limit(value, threads, stats_ptr)
+                    : session->extend_interval(value, threads, stats_ptr);
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    if (!success)
+        return PyErr_Format(PyExc_ValueError, "sieve failed");
+    if (!fill_stats(stats_dict, stats_ptr))
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+Sieve_extend_limit(SieveObject *self, PyObject *args)
+{
+    return Sieve_extend(self, args, true);
+}
+
+static PyObject*
+Sieve_extend_interval(SieveObject *self, PyObject *args)
+{
+    return Sieve_extend(self, args, false);
+}
+
+static PyObject*
+Sieve_survivors(SieveObject *self, PyObject *Py_UNUSED(ignored))
+{
+    if (!Sieve_ready(self))
+        return NULL;
+    return PyLong_FromUnsignedLongLong(self->session->survivors());
+}
+
+static PyObject*
+Sieve_composites(SieveObject *self, PyObject *Py_UNUSED(ignored))
+{
+    if (!Sieve_ready(self))
+        return NULL;
+
+    PyObject* composites = PyBytes_FromStringAndSize(NULL, self->session->gap() + 1);
+    if (composites == NULL)
+        return NULL;
+    self->session->expand(PyBytes_AS_STRING(composites));
+    return composites;
+}
+
+static int
+Sieve_init(SieveObject *self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"start", "distance", "max_prime", "threads", "stats", NULL};
+    PyObject *start;
+    uint64_t gap;
+    uint64_t max_prime = 0;
+    int threads = 1;
+    PyObject *stats_dict = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OK|KiO", const_cast<char**>(kwlist),
+                                     &start, &gap, &max_prime, &threads, &stats_dict))
+        return -1;
+
+    // extend_* in another thread is still using the session.
+    if (self->busy) {
+        PyErr_Format(PyExc_RuntimeError, "Sieve is being extended in another thread");
+        return -1;
+    }
+
+    if (!check_sieve_args(gap, std::max<uint64_t>(max_prime, 1), threads))
+        return -1;
+
+    // Keep m * P# / d + a so residues of primes <= P are free.
+    residue::Primorial form;
+    bool has_form = false;
+    if (PyUnicode_Check(start)) {
+        const char *str = PyUnicode_AsUTF8(start);
+        if (str == NULL)
+            return -1;
+        has_form = parsenumber::parse_primorial_standard_form(str, form);
+    }
+
+    mpz_t n;
+    if (!init_and_check_n(n, start)) {
+        mpz_clear(n);
+        return -1;
+    }
+
+    delete self->session;
+    self->session = new sieve_util::Session(n, has_form ? &form : nullptr, gap);
+    self->threads = threads;
+    mpz_clear(n);
+
+    if (max_prime > 0) {
+        PyObject *extend_args = Py_BuildValue("(KO)", max_prime, stats_dict ? stats_dict : Py_None);
+        if (extend_args == NULL)
+            return -1;
+        PyObject *result = Sieve_extend_limit(self, extend_args);
+        Py_DECREF(extend_args);
+        if (result == NULL)
+            return -1;
+        Py_DECREF(result);
+    }
+    return 0;
+}
+
+static PyObject*
+Sieve_get(SieveObject *self, void *closure)
+{
+    if (!Sieve_ready(self))
+        return NULL;
+    switch ((intptr_t) closure) {
+        case 0: return PyLong_FromUnsignedLongLong(self->session->gap());
+        case 1: return PyLong_FromUnsignedLongLong(self->session->limit());
+        default: return PyLong_FromSize_t(self->session->prime_count());
+    }
+}
+
+static PyMethodDef Sieve_methods[] = {
+    {"extend_limit", (PyCFunction) Sieve_extend_limit, METH_VARARGS,
+     "Sieve primes in (max_prime, new_max_prime]"},
+    {"extend_interval", (PyCFunction) Sieve_extend_interval, METH_VARARGS,
+     "Sieve (distance, new_distance]"},
+    {"survivors", (PyCFunction) Sieve_survivors, METH_NOARGS,
+     "Count of numbers not known to be composite"},
+    {"composites", (PyCFunction) Sieve_composites, METH_NOARGS,
+     "Status (1 composite or 0 unknown) for distance+1 numbers"},
+    {NULL}  /* Sentinel */
+};
+
+static PyGetSetDef Sieve_getset[] = {
+    {"distance", (getter) Sieve_get, NULL, "size of interval", (void *) 0},
+    {"max_prime", (getter) Sieve_get, NULL, "sieve limit", (void *) 1},
+    {"prime_count", (getter) Sieve_get, NULL, "primes sieved so far", (void *) 2},
+    {NULL}  /* Sentinel */
+};
+
+PyTypeObject SieveType = [] {
+    PyTypeObject type = {PyVarObject_HEAD_INIT(NULL, 0)};
+    type.tp_name = "verify.Sieve";
+    type.tp_doc = doc_sieve_session;
+    type.tp_basicsize = sizeof(SieveObject);
+    type.tp_flags = Py_TPFLAGS_DEFAULT;
+    type.tp_new = PyType_GenericNew;
+    type.tp_init = (initproc) Sieve_init;
+    type.tp_dealloc = (destructor) Sieve_dealloc;
+    type.tp_methods = Sieve_methods;
+    type.tp_getset = Sieve_getset;
+    return type;
+}();
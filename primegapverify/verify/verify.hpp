@@ -18,8 +18,30 @@
 
 extern const char doc_sieve_interval[];
 extern const char doc_sieve_factor_interval[];
+extern const char doc_sieve_factor_interval_compact[];
+extern const char doc_sieve_primorial_interval[];
+extern const char doc_sieve_primorial_range[];
+extern const char doc_sieve_primorial_batch[];
+extern const char doc_validate_interval[];
+extern const char doc_sieve_interval_windowed[];
+extern const char doc_write_prime_table[];
+extern const char doc_generate_certificate[];
+extern const char doc_check_certificate[];
 extern const char doc_sieve_limit[];
+extern const char doc_sieve_session[];
 
 PyObject* sieve_interval(PyObject *self, PyObject *args);
 PyObject* sieve_factor_interval(PyObject *self, PyObject *args);
+PyObject* sieve_factor_interval_compact(PyObject *self, PyObject *args);
+PyObject* sieve_primorial_interval(PyObject *self, PyObject *args);
+PyObject* sieve_primorial_range(PyObject *self, PyObject *args);
+PyObject* sieve_primorial_batch(PyObject *self, PyObject *args);
+PyObject* validate_interval(PyObject *self, PyObject *args);
+PyObject* sieve_interval_windowed(PyObject *self, PyObject *args);
+PyObject* write_prime_table(PyObject *self, PyObject *args);
+PyObject* generate_certificate(PyObject *self, PyObject *args);
+PyObject* check_certificate(PyObject *self, PyObject *args);
 PyObject* sieve_limit(PyObject *self, PyObject *args);
+
+// verify.Sieve, an extendable sieve_util::Session
+extern PyTypeObject SieveType;
@@ -20,6 +20,15 @@
 static PyMethodDef VerifyMethods[] = {
     {"sieve_interval",  sieve_interval, METH_VARARGS, doc_sieve_interval},
     {"sieve_factor_interval",  sieve_factor_interval, METH_VARARGS, doc_sieve_factor_interval},
+    {"sieve_factor_interval_compact",  sieve_factor_interval_compact, METH_VARARGS, doc_sieve_factor_interval_compact},
+    {"sieve_primorial_interval",  sieve_primorial_interval, METH_VARARGS, doc_sieve_primorial_interval},
+    {"sieve_primorial_range",  sieve_primorial_range, METH_VARARGS, doc_sieve_primorial_range},
+    {"sieve_primorial_batch",  sieve_primorial_batch, METH_VARARGS, doc_sieve_primorial_batch},
+    {"validate_interval",  validate_interval, METH_VARARGS, doc_validate_interval},
+    {"sieve_interval_windowed",  sieve_interval_windowed, METH_VARARGS, doc_sieve_interval_windowed},
+    {"write_prime_table",  write_prime_table, METH_VARARGS, doc_write_prime_table},
+    {"generate_certificate",  generate_certificate, METH_VARARGS, doc_generate_certificate},
+    {"check_certificate",  check_certificate, METH_VARARGS, doc_check_certificate},
     {"sieve_limit",  sieve_limit, METH_VARARGS, doc_sieve_limit},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
@@ -36,5 +45,18 @@ static struct PyModuleDef verify_module = {
 PyMODINIT_FUNC
 PyInit_verify(void)
 {
-    return PyModule_Create(&verify_module);
+    if (PyType_Ready(&SieveType) < 0)
+        return NULL;
+
+    PyObject *module = PyModule_Create(&verify_module);
+    if (module == NULL)
+        return NULL;
+
+    Py_INCREF(&SieveType);
+    if (PyModule_AddObject(module, "Sieve", (PyObject *) &SieveType) < 0) {
+        Py_DECREF(&SieveType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
 }
@@ -7,10 +7,18 @@ ext = Extension(
     sources=[
         "primegapverify/verify/verifymodule.cpp",
         "primegapverify/verify/verify.cpp",
+        "primegapverify/verify/autotune.cpp",
+        "primegapverify/verify/certificate.cpp",
+        "primegapverify/verify/checkpoint.cpp",
+        "primegapverify/verify/parsenumber.cpp",
         "primegapverify/verify/primes.cpp",
+        "primegapverify/verify/prp.cpp",
+        "primegapverify/verify/residue.cpp",
         "primegapverify/verify/sieve_util.cpp",
     ],
     undef_macros=['NDEBUG'],
+    extra_compile_args=["-pthread"],
+    extra_link_args=["-pthread"],
 )
 
 # Load version without trying to load module